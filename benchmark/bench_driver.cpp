@@ -0,0 +1,235 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs obstack against bench_target in every capture and unwinder mode and
+ * reports, per mode, the median over the rounds of: wall time, capture time
+ * (attach of the first thread to detach of the last), per-thread pause
+ * percentiles, symbolization time and peak RSS of obstack.
+ *
+ *   bench_driver --obstack=PATH --target=PATH [--threads=N] [--depth=N]
+ *                [--libs=N] [--rounds=N] [--modes=a,b,...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct Mode
+{
+  const char *name_;
+  vector<string> args_;  // before the pid, or the file for load_raw
+};
+
+struct Result
+{
+  double wall_ms_;
+  double capture_ms_;
+  long pause_us_[4];     // p50, p90, p99, max
+  double symbolize_ms_;
+  long peak_rss_kb_;
+};
+
+static const char *RAW_FILE = "bench_driver.raw";
+
+static vector<Mode> all_modes()
+{
+  return {
+    {"default", {}},
+    {"agg", {"-a"}},
+    {"no_lineno", {"-o"}},
+    {"no_parse", {"-n"}},
+    {"save_raw", {"--save_raw", RAW_FILE}},
+    // offline unwinder, run against the file saved by save_raw
+    {"load_raw", {"--load_raw", RAW_FILE}},
+  };
+}
+
+static double now_ms()
+{
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static int start_target(const char *target, int threads, int depth, int libs, pid_t *pid)
+{
+  int fds[2];
+  if (0 != pipe(fds)) return -1;
+  *pid = fork();
+  if (0 == *pid) {
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[0]);
+    string t = to_string(threads), d = to_string(depth), l = to_string(libs);
+    execl(target, target, t.c_str(), d.c_str(), l.c_str(), (char *)nullptr);
+    _exit(127);
+  }
+  close(fds[1]);
+  FILE *fp = fdopen(fds[0], "r");
+  int ready_pid = -1;
+  if (!fp || 1 != fscanf(fp, "ready %d", &ready_pid)) {
+    fprintf(stderr, "target failed to start\n");
+    return -1;
+  }
+  fclose(fp);
+  return 0;
+}
+
+static int run_obstack(const char *obstack, const Mode &mode, pid_t target_pid, Result &result)
+{
+  int fds[2];
+  if (0 != pipe(fds)) return -1;
+  double start = now_ms();
+  pid_t pid = fork();
+  if (0 == pid) {
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(fds[1], STDERR_FILENO);
+    close(fds[0]);
+    vector<string> args{obstack};
+    args.insert(args.end(), mode.args_.begin(), mode.args_.end());
+    if (0 != strcmp(mode.name_, "load_raw")) {
+      args.push_back(to_string(target_pid));
+    }
+    vector<char *> argv;
+    for (auto &&arg : args) argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+    execv(obstack, argv.data());
+    _exit(127);
+  }
+  close(fds[1]);
+  memset(&result, 0, sizeof(result));
+  FILE *fp = fdopen(fds[0], "r");
+  char line[4096];
+  while (fgets(line, sizeof(line), fp)) {
+    const char *cost = strstr(line, "cost(ms): ");
+    const char *pause = strstr(line, "p50: ");
+    if (strstr(line, "all tracees detached") && cost) {
+      result.capture_ms_ = atof(cost + strlen("cost(ms): "));
+    } else if (strstr(line, "parse addrs finish") && cost) {
+      result.symbolize_ms_ += atof(cost + strlen("cost(ms): "));
+    } else if (strstr(line, "thread pause(us)") && pause) {
+      sscanf(pause, "p50: %ld, p90: %ld, p99: %ld, max: %ld",
+             &result.pause_us_[0], &result.pause_us_[1], &result.pause_us_[2], &result.pause_us_[3]);
+    }
+  }
+  fclose(fp);
+  int status = 0;
+  struct rusage usage;
+  if (-1 == wait4(pid, &status, 0, &usage) || !WIFEXITED(status) || 0 != WEXITSTATUS(status)) {
+    fprintf(stderr, "obstack failed, mode: %s, status: %d\n", mode.name_, status);
+    return -1;
+  }
+  result.wall_ms_ = now_ms() - start;
+  // includes the capturing child, which obstack waits for
+  result.peak_rss_kb_ = usage.ru_maxrss;
+  return 0;
+}
+
+template<typename T>
+static T median(vector<Result> &results, T Result::*field)
+{
+  vector<T> values;
+  for (auto &&r : results) values.push_back(r.*field);
+  sort(values.begin(), values.end());
+  return values[values.size() / 2];
+}
+
+static long median_pause(vector<Result> &results, int i)
+{
+  vector<long> values;
+  for (auto &&r : results) values.push_back(r.pause_us_[i]);
+  sort(values.begin(), values.end());
+  return values[values.size() / 2];
+}
+
+static void usage_exit(const char *prog)
+{
+  fprintf(stderr, "Usage: %s --obstack=PATH --target=PATH [--threads=1000] [--depth=32] [--libs=4] "
+          "[--rounds=3] [--modes=default,agg,no_lineno,no_parse,save_raw,load_raw]\n", prog);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  const char *obstack = nullptr;
+  const char *target = nullptr;
+  int threads = 1000, depth = 32, libs = 4, rounds = 3;
+  string modes_arg;
+  static struct option long_options[] = {
+    {"obstack", required_argument, nullptr, 'o'},
+    {"target", required_argument, nullptr, 't'},
+    {"threads", required_argument, nullptr, 'n'},
+    {"depth", required_argument, nullptr, 'd'},
+    {"libs", required_argument, nullptr, 'l'},
+    {"rounds", required_argument, nullptr, 'r'},
+    {"modes", required_argument, nullptr, 'm'},
+    {nullptr, 0, nullptr, 0},
+  };
+  int c;
+  while ((c = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+    switch (c) {
+    case 'o': obstack = optarg; break;
+    case 't': target = optarg; break;
+    case 'n': threads = atoi(optarg); break;
+    case 'd': depth = atoi(optarg); break;
+    case 'l': libs = atoi(optarg); break;
+    case 'r': rounds = max(1, atoi(optarg)); break;
+    case 'm': modes_arg = string(",") + optarg + ","; break;
+    default: usage_exit(argv[0]);
+    }
+  }
+  if (!obstack || !target) usage_exit(argv[0]);
+
+  pid_t target_pid = -1;
+  if (0 != start_target(target, threads, depth, libs, &target_pid)) {
+    return 1;
+  }
+  printf("threads: %d, depth: %d, libs: %d, rounds: %d\n", threads, depth, libs, rounds);
+  printf("%-10s %10s %11s %9s %9s %9s %9s %13s %12s\n", "mode", "wall(ms)", "capture(ms)",
+         "p50(us)", "p90(us)", "p99(us)", "max(us)", "symbolize(ms)", "peak_rss(MB)");
+  int rc = 0;
+  for (auto &&mode : all_modes()) {
+    if (!modes_arg.empty() && string::npos == modes_arg.find(string(",") + mode.name_ + ",")) continue;
+    vector<Result> results(rounds);
+    for (int i = 0; i < rounds && 0 == rc; i++) {
+      rc = run_obstack(obstack, mode, target_pid, results[i]);
+    }
+    if (0 != rc) break;
+    printf("%-10s %10.1f %11.1f %9ld %9ld %9ld %9ld %13.1f %12.1f\n", mode.name_,
+           median(results, &Result::wall_ms_), median(results, &Result::capture_ms_),
+           median_pause(results, 0), median_pause(results, 1), median_pause(results, 2), median_pause(results, 3),
+           median(results, &Result::symbolize_ms_), median(results, &Result::peak_rss_kb_) / 1024.0);
+    fflush(stdout);
+  }
+  kill(target_pid, SIGKILL);
+  waitpid(target_pid, nullptr, 0);
+  unlink(RAW_FILE);
+  return rc;
+}
@@ -0,0 +1,32 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * One of the shared libraries the synthetic target descends through, built
+ * several times with a different BENCH_LIB_ID.
+ */
+
+#define BENCH_CONCAT2(a, b) a##b
+#define BENCH_CONCAT(a, b) BENCH_CONCAT2(a, b)
+#define BENCH_LIB_FRAME BENCH_CONCAT(BENCH_CONCAT(bench_lib, BENCH_LIB_ID), _frame)
+
+extern "C" __attribute__((noinline)) void BENCH_LIB_FRAME(int depth, void (*next)(int))
+{
+  next(depth - 1);
+  // keep the frame, no tail call
+  asm volatile("" ::: "memory");
+}
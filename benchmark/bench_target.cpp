@@ -0,0 +1,111 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Synthetic target for the capture benchmark: parks a number of threads at
+ * a given stack depth, every few frames passing through one of the shared
+ * libraries, then prints "ready <pid>" and waits to be killed.
+ *
+ *   bench_target [threads] [depth] [libs]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <atomic>
+
+#define BENCH_LIB_DECL(i) extern "C" void bench_lib##i##_frame(int depth, void (*next)(int));
+BENCH_LIB_DECL(0)
+BENCH_LIB_DECL(1)
+BENCH_LIB_DECL(2)
+BENCH_LIB_DECL(3)
+BENCH_LIB_DECL(4)
+BENCH_LIB_DECL(5)
+BENCH_LIB_DECL(6)
+BENCH_LIB_DECL(7)
+
+static void (*lib_frames[])(int, void (*)(int)) = {
+  bench_lib0_frame, bench_lib1_frame, bench_lib2_frame, bench_lib3_frame,
+  bench_lib4_frame, bench_lib5_frame, bench_lib6_frame, bench_lib7_frame,
+};
+static const int MAX_LIBS = sizeof(lib_frames) / sizeof(lib_frames[0]);
+
+static int n_libs = 4;
+static int lib_every = 1;
+static std::atomic<int> n_parked(0);
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+static void park()
+{
+  pthread_mutex_lock(&mutex);
+  n_parked++;
+  // never signaled
+  while (true) {
+    pthread_cond_wait(&cond, &mutex);
+  }
+}
+
+__attribute__((noinline)) static void descend(int depth)
+{
+  if (depth <= 0) {
+    park();
+  } else if (n_libs > 0 && 0 == depth % lib_every) {
+    lib_frames[depth / lib_every % n_libs](depth, descend);
+  } else {
+    descend(depth - 1);
+  }
+  asm volatile("" ::: "memory");
+}
+
+static void *thread_func(void *arg)
+{
+  descend((int)(long)arg);
+  return nullptr;
+}
+
+int main(int argc, char **argv)
+{
+  int n_threads = argc > 1 ? atoi(argv[1]) : 1000;
+  int depth = argc > 2 ? atoi(argv[2]) : 32;
+  n_libs = argc > 3 ? atoi(argv[3]) : 4;
+  if (n_threads <= 0 || depth < 0 || n_libs < 0 || n_libs > MAX_LIBS) {
+    fprintf(stderr, "usage: %s [threads] [depth] [libs<=%d]\n", argv[0], MAX_LIBS);
+    return 1;
+  }
+  lib_every = n_libs > 0 ? depth / (n_libs + 1) + 1 : 1;
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 256 << 10);
+  for (int i = 0; i < n_threads; i++) {
+    pthread_t thread;
+    if (0 != pthread_create(&thread, &attr, thread_func, (void *)(long)depth)) {
+      fprintf(stderr, "pthread_create failed, created: %d\n", i);
+      return 1;
+    }
+  }
+  while (n_parked < n_threads) {
+    usleep(1000);
+  }
+  printf("ready %d\n", getpid());
+  fflush(stdout);
+  while (true) {
+    pause();
+  }
+}
@@ -0,0 +1,256 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmarks of the symbolizer internals, one component at a time,
+ * over generated address sets. The default binary is this benchmark itself,
+ * which links LLVM and binutils statically: a large symbol table and, in a
+ * debug build, heavy DWARF.
+ *
+ *   obstack_microbench [--binary=PATH] [--addrs=N] [--modules=N] [--rounds=N] [--filter=NAME]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include "bfd/bfd_utils.h"
+#include "lib/demangle.h"
+#include "llvmtool/llvm-dwarfdump.h"
+#include "common/config.h"
+#include "common/log.h"
+#include "utils/util.h"
+
+using namespace std;
+using namespace _obstack;
+using namespace _obstack::bfdutils;
+using _obstack::common::current_time;
+
+static string binary = "/proc/self/exe";
+static int n_addrs = 100000;
+static int n_modules = 1000;
+static int rounds = 3;
+static const char *filter = nullptr;
+
+static void report(const char *name, int64_t items, int64_t cost_us, const char *note = "")
+{
+  printf("%-24s %10ld %12.3f %12.1f  %s\n", name, items, cost_us / 1000.0,
+         items > 0 ? cost_us * 1000.0 / items : 0.0, note);
+  fflush(stdout);
+}
+
+static bool enabled(const char *name)
+{
+  return !filter || strstr(name, filter);
+}
+
+// symbol addresses of binary plus a small offset, as link-time addresses
+static vector<ulong> gen_symbol_addrs(const SymbolTable &st, mt19937_64 &rng)
+{
+  vector<ulong> addrs;
+  if (st.sym_ents_.empty()) return addrs;
+  uniform_int_distribution<size_t> pick(0, st.sym_ents_.size() - 1);
+  uniform_int_distribution<ulong> offset(0, 63);
+  for (int i = 0; i < n_addrs; i++) {
+    addrs.push_back(st.sym_ents_[pick(rng)].addr_ + offset(rng));
+  }
+  return addrs;
+}
+
+static SymbolTable *bench_load_symbols()
+{
+  SymbolTable *st = nullptr;
+  for (int r = 0; r < rounds; r++) {
+    string file = binary;
+    int64_t s_ts = current_time();
+    auto *bfd_info = new BFDInfo(file, file);
+    if (!bfd_info->init()) {
+      fprintf(stderr, "open failed: %s\n", binary.c_str());
+      exit(1);
+    }
+    st = new SymbolTable();
+    st->bfd_info_ = bfd_info;
+    bfd_info->load_symbols(st);
+    if (enabled("load_symbols")) {
+      report("load_symbols", st->sym_ents_.size(), current_time() - s_ts, "items: symbols");
+    }
+  }
+  return st;
+}
+
+static void bench_find_pt_load(mt19937_64 &rng)
+{
+  static const ulong BASE = 0x7f0000000000UL;
+  static const ulong SPAN = 1UL << 24;
+  BFDCache cache;
+  auto *st = cache.create_synthetic_st("bench", {});
+  // every module is followed by a gap of the same size
+  for (int i = 0; i < n_modules; i++) {
+    cache.create_synthetic_pt_load(st, BASE + i * SPAN, BASE + i * SPAN + SPAN / 2);
+  }
+  cache.sort_pt_load();
+  uniform_int_distribution<ulong> dist(BASE, BASE + n_modules * SPAN - 1);
+  vector<ulong> addrs(n_addrs);
+  for (auto &&addr : addrs) addr = dist(rng);
+  for (int r = 0; r < rounds; r++) {
+    int64_t found = 0;
+    int64_t s_ts = current_time();
+    for (auto addr : addrs) {
+      found += nullptr != cache.find_pt_load(addr);
+    }
+    char note[64];
+    snprintf(note, sizeof(note), "modules: %d, found: %ld", n_modules, found);
+    report("find_pt_load", addrs.size(), current_time() - s_ts, note);
+  }
+}
+
+static void bench_addr2symbol(const vector<ulong> &offsets)
+{
+  static const ulong START = 0x100000000000UL;
+  BFDCache cache;
+  string file = binary;
+  auto *meta = ELF_META.get(file);
+  ulong end = START;
+  for (auto &&seg : meta->segments_) {
+    end = std::max(end, START + seg.vaddr_ + seg.memsz_ - meta->load_vaddr_);
+  }
+  auto *pt_load = cache.create_new_pt_load(file, (void *)START, (void *)end, false, true);
+  cache.sort_pt_load();
+  if (!pt_load) {
+    fprintf(stderr, "create pt load failed: %s\n", binary.c_str());
+    return;
+  }
+  vector<ulong> addrs;
+  for (auto offset : offsets) {
+    addrs.push_back(offset + (pt_load->addr_start_ - pt_load->load_vaddr_));
+  }
+  // the first pass fills the location cache of BFDCache
+  const char *names[] = {"addr2symbol(cold)", "addr2symbol(warm)"};
+  for (auto *name : names) {
+    int64_t resolved = 0;
+    int64_t s_ts = current_time();
+    for (auto addr : addrs) {
+      cache.addr2symbol((void *)addr, [&](const char *file, const char *function, const char *filename, unsigned int line) {
+                                        resolved += nullptr != function && 0 != strcmp(function, "???");
+                                      });
+    }
+    char note[64];
+    snprintf(note, sizeof(note), "resolved: %ld", resolved);
+    report(name, addrs.size(), current_time() - s_ts, note);
+  }
+}
+
+static void bench_addr2line(const vector<ulong> &offsets)
+{
+  for (int r = 0; r < rounds; r++) {
+    vector<ulong> addrs(offsets);
+    vector<LineInfo> line_infos(addrs.size());
+    int64_t s_ts = current_time();
+    LLVMDwarfDump dwarf_dump(binary.c_str());
+    dwarf_dump.addr2line(addrs, line_infos);
+    int64_t cost = current_time() - s_ts;
+    int64_t resolved = 0;
+    for (auto &&info : line_infos) {
+      resolved += info.line_ > 0;
+    }
+    char note[64];
+    snprintf(note, sizeof(note), "resolved: %ld", resolved);
+    report("addr2line", addrs.size(), cost, note);
+  }
+}
+
+static void bench_demangle(const SymbolTable &st)
+{
+  vector<const char *> names;
+  for (auto &&ent : st.sym_ents_) {
+    if (0 == strncmp(ent.name_.c_str(), "_Z", 2)) names.push_back(ent.name_.c_str());
+  }
+  vector<const char *> demangled(names.size());
+  if (enabled("demangle")) {
+    int64_t s_ts = current_time();
+    for (int i = 0; i < names.size(); i++) {
+      demangled[i] = DEMANGLER.demangle(names[i]);
+    }
+    report("demangle", names.size(), current_time() - s_ts, CONF.llvm_demangle ? "backend: llvm" : "backend: gnu");
+  } else {
+    for (int i = 0; i < names.size(); i++) {
+      demangled[i] = DEMANGLER.demangle(names[i]);
+    }
+  }
+  if (enabled("simplify_name")) {
+    int64_t s_ts = current_time();
+    size_t len = 0;
+    for (auto *name : demangled) {
+      len += lib::simplify_name(name).length();
+    }
+    char note[64];
+    snprintf(note, sizeof(note), "chars: %zu", len);
+    report("simplify_name", demangled.size(), current_time() - s_ts, note);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  static struct option long_options[] = {
+    {"binary", required_argument, nullptr, 'b'},
+    {"addrs", required_argument, nullptr, 'n'},
+    {"modules", required_argument, nullptr, 'm'},
+    {"rounds", required_argument, nullptr, 'r'},
+    {"filter", required_argument, nullptr, 'f'},
+    {"demangler", required_argument, nullptr, 'd'},
+    {nullptr, 0, nullptr, 0},
+  };
+  int c;
+  while ((c = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+    switch (c) {
+    case 'b': binary = optarg; break;
+    case 'n': n_addrs = atoi(optarg); break;
+    case 'm': n_modules = atoi(optarg); break;
+    case 'r': rounds = atoi(optarg); break;
+    case 'f': filter = optarg; break;
+    case 'd': CONF.llvm_demangle = 0 == strcmp(optarg, "llvm"); break;
+    default:
+      fprintf(stderr, "Usage: %s [--binary=PATH] [--addrs=N] [--modules=N] [--rounds=N] "
+              "[--filter=NAME] [--demangler=gnu|llvm]\n", argv[0]);
+      return 1;
+    }
+  }
+  common::g_log_level = common::LogLevel::WARN;
+  printf("binary: %s, addrs: %d, rounds: %d\n", binary.c_str(), n_addrs, rounds);
+  printf("%-24s %10s %12s %12s  %s\n", "benchmark", "items", "total(ms)", "ns/item", "");
+
+  mt19937_64 rng(42);
+  SymbolTable *st = bench_load_symbols();
+  vector<ulong> offsets = gen_symbol_addrs(*st, rng);
+  if (enabled("find_pt_load")) {
+    bench_find_pt_load(rng);
+  }
+  if (enabled("addr2symbol")) {
+    bench_addr2symbol(offsets);
+  }
+  if (enabled("addr2line")) {
+    bench_addr2line(offsets);
+  }
+  if (enabled("demangle") || enabled("simplify_name")) {
+    bench_demangle(*st);
+  }
+  return 0;
+}
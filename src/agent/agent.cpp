@@ -0,0 +1,407 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * libobstack_agent.so, linked into or LD_PRELOADed by a process that wants
+ * to be captured without ptrace, see agent/agent.h for the protocol.
+ *
+ * The agent thread interrupts each thread with a realtime signal, the
+ * handler saves the registers of the interrupted context and copies the top
+ * of its stack, obstack unwinds them with the DWARF tables of the modules.
+ * Unwinding in place would not be async-signal-safe: backtrace() may block
+ * on the loader or libgcc locks held by the very thread it interrupted. The
+ * copy stays in the rw mapping holding the stack pointer, read from
+ * /proc/self/maps by the agent thread before it signals.
+ *
+ * Handlers write into slots owned by the agent, never into the shared memory
+ * of a request, so a handler running late cannot fault. A handler claims its
+ * slot and checks the generation again before writing it, the agent copies
+ * the unclaimed slots stamped with the current generation once every
+ * handler is done or the request times out, so a late handler never writes
+ * a slot that is being copied or reused. Set OBSTACK_AGENT_SIGNAL=N to use
+ * SIGRTMIN+N, default 3; the agent stays off when the process already
+ * handles that signal.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <ucontext.h>
+#include "agent/agent.h"
+#include "lib/macro_utils.h"
+
+namespace _obstack
+{
+namespace agent
+{
+struct Slot
+{
+  std::atomic<int> gen_; // published last, the slot is valid for this generation
+  std::atomic<int> busy_; // claimed by a handler
+  Thread thread_;
+};
+
+static int g_sig = -1;
+static Slot *g_slots = nullptr;
+static std::atomic<int> g_gen(0);
+static std::atomic<int> g_next(0);
+static std::atomic<int> g_done(0);
+static std::atomic<int> g_inflight(0);
+
+struct Range
+{
+  ulong start_;
+  ulong end_;
+};
+struct Ranges
+{
+  int n_;
+  Range ranges_[8192];
+};
+// rw mappings, two sets: a request fills one while a late handler of the
+// one before may still read the other
+static Ranges *g_ranges = nullptr;
+
+static Ranges &ranges_of(int gen)
+{
+  return g_ranges[(gen / 2) & 1];
+}
+
+// agent thread only
+static void read_ranges(Ranges &ranges)
+{
+  ranges.n_ = 0;
+  FILE *fp = fopen("/proc/self/maps", "rt");
+  if (!fp) return;
+  char line[512];
+  ulong start = 0, end = 0;
+  char perms[8];
+  while (ranges.n_ < ARRAYSIZE(ranges.ranges_) && fgets(line, sizeof(line), fp)) {
+    if (3 == sscanf(line, "%lx-%lx %7s", &start, &end, perms) && 'r' == perms[0] && 'w' == perms[1]) {
+      ranges.ranges_[ranges.n_++] = Range{.start_ = start, .end_ = end};
+    }
+  }
+  fclose(fp);
+}
+
+static int64_t now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void save_regs(void *uc, struct user_regs_struct *regs)
+{
+  memset(regs, 0, sizeof(*regs));
+#if defined(__x86_64__)
+  auto &gregs = ((ucontext_t *)uc)->uc_mcontext.gregs;
+  regs->r15 = gregs[REG_R15];
+  regs->r14 = gregs[REG_R14];
+  regs->r13 = gregs[REG_R13];
+  regs->r12 = gregs[REG_R12];
+  regs->rbp = gregs[REG_RBP];
+  regs->rbx = gregs[REG_RBX];
+  regs->r11 = gregs[REG_R11];
+  regs->r10 = gregs[REG_R10];
+  regs->r9 = gregs[REG_R9];
+  regs->r8 = gregs[REG_R8];
+  regs->rax = gregs[REG_RAX];
+  regs->rcx = gregs[REG_RCX];
+  regs->rdx = gregs[REG_RDX];
+  regs->rsi = gregs[REG_RSI];
+  regs->rdi = gregs[REG_RDI];
+  regs->rip = gregs[REG_RIP];
+  regs->eflags = gregs[REG_EFL];
+  regs->rsp = gregs[REG_RSP];
+#elif defined(__aarch64__)
+  auto &mc = ((ucontext_t *)uc)->uc_mcontext;
+  memcpy(regs->regs, mc.regs, sizeof(regs->regs));
+  regs->sp = mc.sp;
+  regs->pc = mc.pc;
+  regs->pstate = mc.pstate;
+#endif
+}
+
+// from below the stack pointer, a leaf function may use the red zone, up to
+// STACK_SIZE bytes or the end of the stack mapping
+static void copy_stack(const Ranges &ranges, Thread &t)
+{
+#if defined(__x86_64__)
+  static const ulong RED_ZONE = 128;
+  ulong sp = t.regs_.rsp;
+#elif defined(__aarch64__)
+  static const ulong RED_ZONE = 0;
+  ulong sp = t.regs_.sp;
+#else
+  static const ulong RED_ZONE = 0;
+  ulong sp = 0;
+#endif
+  t.stack_start_ = sp;
+  t.stack_len_ = 0;
+  const Range *end = ranges.ranges_ + ranges.n_;
+  const Range *stack = std::upper_bound(ranges.ranges_, end, sp,
+                                        [](ulong addr, const Range &r) { return addr < r.end_; });
+  if (stack == end || sp < stack->start_) {
+    return;
+  }
+  ulong start = std::max(sp - RED_ZONE, stack->start_);
+  t.stack_start_ = start;
+  t.stack_len_ = std::min<ulong>(STACK_SIZE, stack->end_ - start);
+  memcpy(t.stack_, (const void *)start, t.stack_len_);
+}
+
+static void on_signal(int, siginfo_t *info, void *uc)
+{
+  int saved_errno = errno;
+  g_inflight++;
+  int gen = g_gen.load();
+  // queued by an earlier request, or not sent by the agent at all
+  if (SI_QUEUE == info->si_code && info->si_pid == getpid() && info->si_value.sival_int == gen) {
+    int64_t begin_ns = now_ns();
+    Slot *slot = nullptr;
+    // a slot still held by a late handler is skipped
+    while (!slot) {
+      int idx = g_next++;
+      if (idx >= MAX_THREADS) break;
+      if (0 == g_slots[idx].busy_.exchange(1)) {
+        slot = &g_slots[idx];
+      }
+    }
+    if (slot) {
+      if (gen == g_gen.load()) {
+        auto &t = slot->thread_;
+        t.tid_ = syscall(SYS_gettid);
+        prctl(PR_GET_NAME, t.tname_);
+        save_regs(uc, &t.regs_);
+        copy_stack(ranges_of(gen), t);
+        t.cost_ns_ = now_ns() - begin_ns;
+        slot->gen_.store(gen);
+      }
+      slot->busy_.store(0);
+    }
+    if (gen == g_gen.load()) {
+      g_done++;
+    }
+  }
+  g_inflight--;
+  errno = saved_errno;
+}
+
+static int signal_thread(int tid, int gen)
+{
+  siginfo_t info;
+  memset(&info, 0, sizeof(info));
+  info.si_signo = g_sig;
+  info.si_code = SI_QUEUE;
+  info.si_pid = getpid();
+  info.si_uid = getuid();
+  info.si_value.sival_int = gen;
+  return syscall(SYS_rt_tgsigqueueinfo, getpid(), tid, g_sig, &info);
+}
+
+static Reply capture(Shm *shm, int max_threads, int64_t timeout_us)
+{
+  Reply reply = {.rc_ = 0, .n_threads_ = 0, .n_signaled_ = 0};
+  int64_t deadline = now_ns() + timeout_us * 1000;
+  // a handler of a timed out request may still read the ranges refilled below
+  while (g_inflight > 0 && now_ns() < deadline) {
+    usleep(10);
+  }
+  int gen = ++g_gen;
+  g_next = 0;
+  g_done = 0;
+  read_ranges(ranges_of(gen));
+  int self = syscall(SYS_gettid);
+  DIR *dir = opendir("/proc/self/task");
+  if (!dir) {
+    reply.rc_ = errno;
+    return reply;
+  }
+  struct dirent *ent;
+  while (nullptr != (ent = readdir(dir))) {
+    int tid = atoi(ent->d_name);
+    if (tid <= 0 || tid == self || reply.n_signaled_ >= MAX_THREADS) continue;
+    if (0 == signal_thread(tid, gen)) {
+      reply.n_signaled_++;
+    }
+  }
+  closedir(dir);
+  while (g_done < reply.n_signaled_ && now_ns() < deadline) {
+    usleep(10);
+  }
+  // late handlers fail the generation check from here on
+  ++g_gen;
+  int n = std::min(std::min(g_next.load(), MAX_THREADS), max_threads);
+  for (int i = 0; i < n; i++) {
+    auto &t = g_slots[i].thread_;
+    if (0 == g_slots[i].busy_.load() && g_slots[i].gen_.load() == gen) {
+      // the stack bytes copied only, the rest of the shm pages stay untouched
+      memcpy(&shm->threads_[reply.n_threads_++], &t, offsetof(Thread, stack_) + t.stack_len_);
+    }
+  }
+  shm->n_threads_ = reply.n_threads_;
+  return reply;
+}
+
+// only the owner of the process or root may ask for its stacks
+static bool peer_allowed(int fd)
+{
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  return 0 == getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) &&
+    (0 == cred.uid || geteuid() == cred.uid);
+}
+
+static void serve(int conn)
+{
+  Request req;
+  int shm_fd = -1;
+  char cmsg_buf[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = {.iov_base = &req, .iov_len = sizeof(req)};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cmsg_buf;
+  msg.msg_controllen = sizeof(cmsg_buf);
+  Reply reply = {.rc_ = EINVAL, .n_threads_ = 0, .n_signaled_ = 0};
+  if (sizeof(req) == recvmsg(conn, &msg, MSG_CMSG_CLOEXEC)) {
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && SOL_SOCKET == cmsg->cmsg_level && SCM_RIGHTS == cmsg->cmsg_type) {
+      memcpy(&shm_fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+  }
+  if (!peer_allowed(conn)) {
+    reply.rc_ = EPERM;
+  } else if (shm_fd >= 0 && MAGIC == req.magic_ && req.max_threads_ > 0 && req.max_threads_ <= MAX_THREADS) {
+    size_t size = shm_size(req.max_threads_);
+    struct stat st;
+    // a shorter file would fault the agent, not obstack, once it is written
+    if (0 != fstat(shm_fd, &st)) {
+      reply.rc_ = errno;
+    } else if (st.st_size < 0 || (size_t)st.st_size < size) {
+      reply.rc_ = EINVAL;
+    } else {
+      void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+      if (MAP_FAILED == ptr) {
+        reply.rc_ = errno;
+      } else {
+        reply = capture((Shm *)ptr, req.max_threads_, req.timeout_us_);
+        munmap(ptr, size);
+      }
+    }
+  }
+  if (shm_fd >= 0) {
+    close(shm_fd);
+  }
+  if (write(conn, &reply, sizeof(reply)) < 0) {
+    // obstack gave up, nothing to tell
+  }
+}
+
+static void *agent_main(void *arg)
+{
+  int fd = (int)(long)arg;
+  prctl(PR_SET_NAME, "obstack_agent");
+  while (true) {
+    int conn = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (conn < 0) {
+      if (EINTR == errno || ECONNABORTED == errno) continue;
+      break;
+    }
+    serve(conn);
+    close(conn);
+  }
+  close(fd);
+  return nullptr;
+}
+
+__attribute__((constructor)) static void agent_init()
+{
+  const char *sig = getenv("OBSTACK_AGENT_SIGNAL");
+  long n = 3;
+  if (sig) {
+    char *end = nullptr;
+    n = strtol(sig, &end, 10);
+    if (end == sig || '\0' != *end || n < 0 || n > SIGRTMAX - SIGRTMIN) {
+      fprintf(stderr, "obstack_agent: OBSTACK_AGENT_SIGNAL=%s is not in [0, %d], agent disabled\n",
+              sig, SIGRTMAX - SIGRTMIN);
+      return;
+    }
+  }
+  g_sig = SIGRTMIN + (int)n;
+  // never take over a signal the process handles itself
+  struct sigaction old_sa;
+  if (0 != sigaction(g_sig, nullptr, &old_sa)) {
+    return;
+  }
+  if ((old_sa.sa_flags & SA_SIGINFO) || (SIG_DFL != old_sa.sa_handler && SIG_IGN != old_sa.sa_handler)) {
+    fprintf(stderr, "obstack_agent: signal %d already has a handler, agent disabled,"
+            " set OBSTACK_AGENT_SIGNAL to another SIGRTMIN offset\n", g_sig);
+    return;
+  }
+  void *ptr = mmap(nullptr, sizeof(Slot) * MAX_THREADS + sizeof(Ranges) * 2, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (MAP_FAILED == ptr) {
+    return;
+  }
+  g_slots = (Slot *)ptr;
+  g_ranges = (Ranges *)(g_slots + MAX_THREADS);
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = on_signal;
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if (0 != sigaction(g_sig, &sa, nullptr)) {
+    return;
+  }
+  struct sockaddr_un addr;
+  socklen_t addr_len = socket_addr(getpid(), &addr);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return;
+  }
+  if (0 != bind(fd, (struct sockaddr *)&addr, addr_len) || 0 != listen(fd, 4)) {
+    close(fd);
+    return;
+  }
+  // the agent thread never runs the handler itself
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  pthread_t thread;
+  if (0 == pthread_create(&thread, nullptr, agent_main, (void *)(long)fd)) {
+    pthread_detach(thread);
+  } else {
+    close(fd);
+  }
+  pthread_sigmask(SIG_SETMASK, &old, nullptr);
+}
+}
+}
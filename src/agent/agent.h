@@ -0,0 +1,94 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGENT_AGENT_H_
+#define AGENT_AGENT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/user.h>
+
+/*
+ * Protocol between obstack and libobstack_agent.so, a library a process
+ * links or LD_PRELOADs to be captured without ptrace. obstack connects to
+ * the abstract unix socket of the pid and sends a Request along with a
+ * shared memory fd (SCM_RIGHTS). The agent interrupts every thread with a
+ * realtime signal, each handler saves its registers and the top of its
+ * stack, and the agent copies them into the shared memory before replying;
+ * obstack unwinds them, as it does --perf_dwarf samples.
+ */
+namespace _obstack
+{
+namespace agent
+{
+static const uint32_t MAGIC = 0x4f424147; // "OBAG"
+static const int MAX_THREADS = 8192;
+// bytes of stack copied per thread, from the stack pointer up
+static const int STACK_SIZE = 16 << 10;
+
+struct Request
+{
+  uint32_t magic_;
+  int max_threads_;     // capacity of Shm::threads_
+  int64_t timeout_us_;  // of all the handlers together
+};
+
+struct Reply
+{
+  int rc_;          // 0 or errno
+  int n_threads_;   // threads written to Shm
+  int n_signaled_;  // threads interrupted, the rest blocked the signal or timed out
+};
+
+struct Thread
+{
+  int tid_;
+  int stack_len_;                // bytes in stack_
+  int64_t cost_ns_;              // time spent in the signal handler
+  char tname_[16];
+  struct user_regs_struct regs_; // of the interrupted context
+  uint64_t stack_start_;         // address of stack_[0]
+  char stack_[STACK_SIZE];
+};
+
+struct Shm
+{
+  int n_threads_;
+  Thread threads_[0];
+};
+
+inline size_t shm_size(int max_threads)
+{
+  return sizeof(Shm) + sizeof(Thread) * max_threads;
+}
+
+// "\0obstack_agent.<pid>", in the abstract namespace, nothing to clean up
+inline socklen_t socket_addr(int pid, struct sockaddr_un *addr)
+{
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  int len = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "obstack_agent.%d", pid);
+  return offsetof(struct sockaddr_un, sun_path) + 1 + len;
+}
+}
+}
+
+#endif // AGENT_AGENT_H_
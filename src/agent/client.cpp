@@ -0,0 +1,206 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "agent/client.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include "bfd/elf_meta.h"
+#include "unwind/file_memory.h"
+#include "unwind/unwinder.h"
+#include "lib/macro_utils.h"
+#include "common/log.h"
+#include "utils/defer.h"
+
+namespace _obstack
+{
+namespace agent
+{
+/*
+ * Memory of a thread the agent captured: the stack bytes its handler
+ * copied, module text from the local files, anything else from the process,
+ * which kept running.
+ */
+class ThreadMemory : public unwind::Memory
+{
+public:
+  ThreadMemory(int pid) : pid_(pid), thread_(nullptr) { files_.load(pid); }
+  void set_thread(const Thread *thread) { thread_ = thread; }
+  int read(ulong addr, void *buf, size_t len) override
+  {
+    if (thread_ && addr >= thread_->stack_start_ && addr + len <= thread_->stack_start_ + thread_->stack_len_) {
+      memcpy(buf, thread_->stack_ + (addr - thread_->stack_start_), len);
+      return 0;
+    }
+    if (0 == files_.read(addr, buf, len)) {
+      return 0;
+    }
+    struct iovec local = {.iov_base = buf, .iov_len = len};
+    struct iovec remote = {.iov_base = (void *)addr, .iov_len = len};
+    return (ssize_t)len == process_vm_readv(pid_, &local, 1, &remote, 1, 0) ? 0 : -1;
+  }
+private:
+  int pid_;
+  unwind::FileMemory files_;
+  const Thread *thread_;
+};
+
+// every file with an executable mapping, from its lowest to its highest mapping
+static void add_modules(int pid, unwind::Unwinder &unwinder)
+{
+  char fn[64];
+  snprintf(fn, sizeof(fn), "/proc/%d/maps", pid);
+  FILE *fp = fopen(fn, "rt");
+  if (!fp) return;
+  DEFER(fclose(fp));
+  char line[1024];
+  char perms[8];
+  char path[512];
+  std::string module;
+  ulong module_start = 0, module_end = 0;
+  bool exec = false;
+  auto flush = [&]() {
+                 if (exec) {
+                   unwinder.add_module(module_start, module_end, ELF_META.get(module));
+                 }
+               };
+  while (fgets(line, sizeof(line), fp)) {
+    ulong start, end;
+    if (4 != sscanf(line, "%lx-%lx %7s %*lx %*x:%*x %*lu %511s", &start, &end, perms, path) || '/' != path[0]) {
+      continue;
+    }
+    if (module != path) {
+      flush();
+      module = path;
+      module_start = start;
+      exec = false;
+    }
+    module_end = end;
+    exec = exec || 'x' == perms[2];
+  }
+  flush();
+}
+
+// an unlinked shm file, passed to the agent by fd so that its uid does not matter
+static int create_shm(int pid, size_t size)
+{
+  char name[64];
+  snprintf(name, sizeof(name), "/obstack_agent.%d.%d", getpid(), pid);
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    return -1;
+  }
+  shm_unlink(name);
+  if (0 != ftruncate(fd, size)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int send_request(int sock, int shm_fd, const Request &req)
+{
+  char cmsg_buf[CMSG_SPACE(sizeof(int))];
+  memset(cmsg_buf, 0, sizeof(cmsg_buf));
+  struct iovec iov = {.iov_base = (void *)&req, .iov_len = sizeof(req)};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cmsg_buf;
+  msg.msg_controllen = sizeof(cmsg_buf);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &shm_fd, sizeof(int));
+  return sizeof(req) == sendmsg(sock, &msg, MSG_NOSIGNAL) ? 0 : errno;
+}
+
+int capture(int pid, int64_t timeout_us, const ThreadCb &cb)
+{
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0) {
+    LOG(WARN, "create socket failed, err: %d, errmsg: %s", errno, strerror(errno));
+    return errno;
+  }
+  DEFER(close(sock));
+  struct sockaddr_un addr;
+  socklen_t addr_len = socket_addr(pid, &addr);
+  if (0 != connect(sock, (struct sockaddr *)&addr, addr_len)) {
+    LOG(WARN, "no agent in process %d, is libobstack_agent.so loaded? err: %d, errmsg: %s",
+        pid, errno, strerror(errno));
+    return errno;
+  }
+  // the agent replies once the handlers are done or timed out, leave it some slack
+  struct timeval tv = {.tv_sec = (timeout_us + 1000000) / 1000000, .tv_usec = 0};
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  size_t size = shm_size(MAX_THREADS);
+  int shm_fd = create_shm(pid, size);
+  if (shm_fd < 0) {
+    LOG(WARN, "create shm failed, err: %d, errmsg: %s", errno, strerror(errno));
+    return errno;
+  }
+  DEFER(close(shm_fd));
+  void *ptr = mmap(nullptr, size, PROT_READ, MAP_SHARED, shm_fd, 0);
+  if (MAP_FAILED == ptr) {
+    LOG(WARN, "mmap shm failed, err: %d, errmsg: %s", errno, strerror(errno));
+    return errno;
+  }
+  DEFER(munmap(ptr, size));
+
+  Request req = {.magic_ = MAGIC, .max_threads_ = MAX_THREADS, .timeout_us_ = timeout_us};
+  int rc = send_request(sock, shm_fd, req);
+  if (0 != rc) {
+    LOG(WARN, "send request to agent failed, pid: %d, err: %d, errmsg: %s", pid, rc, strerror(rc));
+    return rc;
+  }
+  Reply reply;
+  if (sizeof(reply) != read(sock, &reply, sizeof(reply))) {
+    LOG(WARN, "no reply from agent, pid: %d, err: %d, errmsg: %s", pid, errno, strerror(errno));
+    return ETIMEDOUT;
+  }
+  if (0 != reply.rc_) {
+    LOG(WARN, "agent capture failed, pid: %d, err: %d, errmsg: %s", pid, reply.rc_, strerror(reply.rc_));
+    return reply.rc_;
+  }
+  if (reply.n_threads_ < reply.n_signaled_) {
+    LOG(WARN, "%d of %d threads did not run the agent handler in time, pid: %d",
+        reply.n_signaled_ - reply.n_threads_, reply.n_signaled_, pid);
+  }
+  ThreadMemory mem(pid);
+  unwind::Unwinder unwinder(mem);
+  if (0 != unwinder.init()) {
+    return ENOMEM;
+  }
+  add_modules(pid, unwinder);
+  auto *shm = (const Shm *)ptr;
+  ulong addrs[256];
+  for (int i = 0; i < reply.n_threads_ && i < MAX_THREADS; i++) {
+    mem.set_thread(&shm->threads_[i]);
+    int n = unwinder.unwind(shm->threads_[i].regs_, addrs, ARRAYSIZE(addrs));
+    cb(shm->threads_[i], addrs, n);
+  }
+  return 0;
+}
+}
+}
@@ -0,0 +1,37 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGENT_CLIENT_H_
+#define AGENT_CLIENT_H_
+
+#include <functional>
+#include "agent/agent.h"
+
+namespace _obstack
+{
+namespace agent
+{
+static const int64_t DEFAULT_TIMEOUT_US = 1000000;
+
+typedef std::function<void(const Thread &thread, const ulong *addrs, int n)> ThreadCb;
+// capture every thread of pid through its libobstack_agent.so, cb gets the
+// frames of each thread unwound from its registers and stack, innermost first
+int capture(int pid, int64_t timeout_us, const ThreadCb &cb);
+}
+}
+
+#endif // AGENT_CLIENT_H_
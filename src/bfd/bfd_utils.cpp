@@ -25,14 +25,14 @@
 #include <link.h>
 #include <assert.h>
 #include <sys/time.h>
-#include <libelf.h>
-#include <gelf.h>
 #include "common/config.h"
 #include "common/log.h"
 #include "common/error.h"
 #include "common/log.h"
 #include "utils/util.h"
 #include "utils/defer.h"
+#include "lib/demangle.h"
+#include "common/stats.h"
 
 using namespace std;
 
@@ -45,78 +45,6 @@ struct bfd_data
   const char *function;
 };
 
-bool check_shlib(const string& file, ulong &vaddr) {
-  FILE *fp = fopen(file.c_str(), "r");
-  if (fp == 0) {
-    return false;
-  }
-  elf_version(EV_CURRENT);
-  Elf* elf = elf_begin(fileno(fp), ELF_C_READ, nullptr);
-  if (elf == 0) {
-    return false;
-  }
-  vaddr = 0;
-#if defined(__i386__)
-  Elf32_Ehdr* const ehdr = elf32_getehdr(elf);
-  Elf32_Phdr* const phdr = elf32_getphdr(elf);
-#else
-  Elf64_Ehdr* const ehdr = elf64_getehdr(elf);
-  Elf64_Phdr* const phdr = elf64_getphdr(elf);
-#endif
-  if (!ehdr) {
-    return false;
-  }
-  const int num_phdr = ehdr->e_phnum;
-  for (int i = 0; i < num_phdr; ++i) {
-#if defined(__i386__)
-    Elf32_Phdr* const p = phdr + i;
-#else
-    Elf64_Phdr* const p = phdr + i;
-#endif
-    if (p->p_type == PT_LOAD && (p->p_flags & 1) != 0) {
-      vaddr = p->p_vaddr;
-      break;
-    }
-  }
-  elf_end(elf);
-  fclose(fp);
-  return vaddr == 0;
-}
-
-bool check_stripped(const char *file)
-{
-  bool stripped = true;
-  int fd;
-
-  Elf *elf;
-  Elf_Scn *scn;
-  GElf_Shdr shdr;
-
-  elf_version(EV_CURRENT);
-  if((fd = open(file, O_RDONLY)) < 0)
-  {
-    return false;
-  }
-  DEFER(close(fd));
-
-  elf = elf_begin(fd, ELF_C_READ, NULL);
-  DEFER(elf_end(elf));
-
-  scn = NULL;
-
-  while((scn = elf_nextscn(elf, scn)) != NULL)
-  {
-    gelf_getshdr(scn, &shdr);
-
-    if(shdr.sh_type == SHT_SYMTAB)
-    {
-      stripped = false;
-      break;
-    }
-  }
-  return stripped;
-}
-
 bool in_range(ulong addr, PTLoad *pt_load)
 {
   return (addr >= pt_load->addr_start_) &&
@@ -156,8 +84,8 @@ bfd *open_bfd(const char *file)
 
 SymbolTable *BFDInfo::load_symbols(SymbolTable *st)
 {
-  if (check_stripped(abfd_->filename)) {
-    LOG(DEBUG, "no symbols, file: %s", abfd_->filename);
+  if (meta_->stripped_) {
+    LOG(DEBUG, "no symbols, file: %s", file_.c_str());
     return nullptr;
   }
   asection* const text_sec = st->text_section_ = bfd_get_section_by_name(abfd_, ".text");
@@ -183,6 +111,12 @@ SymbolTable *BFDInfo::load_symbols(SymbolTable *st)
   bfd_byte* pend = p + symcnt * size;
   for (; p < pend; p += size) {
     asymbol* sym = bfd_minisymbol_to_symbol(abfd_, dynamic, p, store);
+    if (CONF.futex && (sym->flags & BSF_OBJECT) && !(sym->flags & BSF_THREAD_LOCAL)) {
+      symbol_info sinfo;
+      bfd_get_symbol_info(abfd_, sym, &sinfo);
+      st->data_ents_.push_back({.addr_ = sinfo.value, .name_ = string(sinfo.name), .demangled_ = nullptr});
+      continue;
+    }
     if ((sym->flags & BSF_FUNCTION) == 0) {
       continue;
     }
@@ -196,17 +130,19 @@ SymbolTable *BFDInfo::load_symbols(SymbolTable *st)
       continue;
     if (common::startwith(sinfo.name, "__tz"))
       continue;
-    st->sym_ents_.push_back({.addr_ = sinfo.value, .name_ = string(sinfo.name)});
+    st->sym_ents_.push_back({.addr_ = sinfo.value, .name_ = string(sinfo.name), .demangled_ = nullptr});
   }
   std::sort(st->sym_ents_.begin(), st->sym_ents_.end(), [](SymbolEnt &l, SymbolEnt &r) {
                                                   return l.addr_ < r.addr_;
                                                 });
+  std::sort(st->data_ents_.begin(), st->data_ents_.end(), [](SymbolEnt &l, SymbolEnt &r) {
+                                                    return l.addr_ < r.addr_;
+                                                  });
   return st;
 }
 
-void trace_bfd_addr(BContext &bctx, PTLoad *pt_load , void *relative_addr, bfd_data *data)
+void trace_bfd_addr(PTLoad *pt_load , void *relative_addr, bfd_data *data)
 {
-  bfd *abfd = pt_load->st_->bfd_info_->abfd_;
   auto &sym_ents = pt_load->st_->sym_ents_;
   auto it = std::upper_bound(sym_ents.begin(), sym_ents.end(), relative_addr, [](void *addr, SymbolEnt &l) {
                                                                        return (ulong)addr < l.addr_;
@@ -217,15 +153,40 @@ void trace_bfd_addr(BContext &bctx, PTLoad *pt_load , void *relative_addr, bfd_d
   } else {
     it--;
   }
-  data->function = it->name_.c_str();
+  if (!it->demangled_) {
+    common::StatsTimer timer("demangle");
+    it->demangled_ = DEMANGLER.demangle(it->name_.c_str());
+  }
+  data->function = it->demangled_;
+}
+
+string BFDCache::data_symbol(SymbolTable *st, ulong offset)
+{
+  if (!st) return "";
+  auto &ents = st->data_ents_;
+  // sizes are not kept, the nearest object below is taken
+  auto it = std::upper_bound(ents.begin(), ents.end(), offset, [](ulong addr, const SymbolEnt &l) {
+                                                               return addr < l.addr_;
+                                                             });
+  if (it == ents.begin()) return "";
+  it--;
+  if (!it->demangled_) {
+    common::StatsTimer timer("demangle");
+    it->demangled_ = DEMANGLER.demangle(it->name_.c_str());
+  }
+  char off[32];
+  snprintf(off, sizeof(off), "+0x%lx", offset - it->addr_);
+  return it->demangled_ + string(off);
 }
 
 BFDCache::BFDCache()
 {
 }
 
-void BFDCache::do_addr2symbol(BContext &bctx, void *addr)
+const Location &BFDCache::addr2location(void *addr)
 {
+  static const Location UNKNOWN_LOC{.file_ = lib::StringPool::UNKNOWN, .function_ = lib::StringPool::UNKNOWN,
+                                    .filename_ = lib::StringPool::UNKNOWN, .line_ = 0};
   total++;
   auto it = loc_cache_.end();
   if ((it = loc_cache_.find(addr)) == loc_cache_.end()) {
@@ -241,55 +202,90 @@ void BFDCache::do_addr2symbol(BContext &bctx, void *addr)
     if (pt_it != pt_loads_.end()) {
       PTLoad *pt_load = *pt_it;
       if (in_range((ulong)addr, pt_load)) {
-        trace_bfd_addr(bctx, pt_load, (void*)addr2offset(pt_load, (ulong)addr), &data);
-        it = loc_cache_.insert({addr, Location{.file_ = pt_load->st_->bfd_info_->file_.c_str(), .function_ = data.function,
-                                               .filename_ = "???", .line_ = 0}}).first;
+        trace_bfd_addr(pt_load, (void*)addr2offset(pt_load, (ulong)addr), &data);
+        it = loc_cache_.insert({addr, Location{.file_ = strings_.intern(pt_load->st_->bfd_info_->file_.c_str()),
+                                               .function_ = strings_.intern(data.function),
+                                               .filename_ = lib::StringPool::UNKNOWN, .line_ = 0}}).first;
       }
     }
   } else {
     hit++;
   }
-  auto &loc = it->second;
   if (it != loc_cache_.end()) {
-    bctx.func_(bctx.arg_, loc.file_.c_str(), loc.function_.c_str(), loc.filename_.c_str(), loc.line_);
-  } else {
-    lack++;
-    LOG(WARN, "no symbol founded: %p", addr);
-    auto *empty = "???";
-    bctx.func_(bctx.arg_, empty, empty, empty, 0);
+    return it->second;
+  }
+  lack++;
+  LOG(WARN, "no symbol founded: %p", addr);
+  return UNKNOWN_LOC;
+}
+
+void BFDInfo::release()
+{
+  if (abfd_) {
+    free(syms_);
+    syms_ = nullptr;
+    bfd_close(abfd_);
+    abfd_ = nullptr;
   }
 }
 
-bfd *BFDInfo::init()
+bool BFDInfo::init()
 {
+  abfd_ = nullptr;
+  syms_ = nullptr;
+  meta_ = ELF_META.get(file_);
+  if (!meta_->valid_) {
+    LOG(WARN, "invalid elf file: %s", file_.c_str());
+    return false;
+  }
+  if (meta_->stripped_) {
+    // nothing to read from a stripped file, don't bother opening it again
+    return true;
+  }
   abfd_ = open_bfd(file_.c_str());
-  if (!abfd_) return nullptr;
+  if (!abfd_) return false;
   abfd_->flags |= BFD_DECOMPRESS;
-  return abfd_;
+  return true;
 }
 
 PTLoad *BFDCache::create_new_pt_load(string &file, void *addr_start, void *addr_end, bool is_exe, bool load_symbols)
 {
   SymbolTable *st = nullptr;
-  ulong load_vaddr = 0;
-  check_shlib(file, load_vaddr);
+  ElfMeta *meta = ELF_META.get(file);
+  ulong load_vaddr = meta->load_vaddr_;
   auto it = st_map_.find(file);
+  common::StatsTimer timer("load module");
+  timer.set_hits(it != st_map_.end());
   if (it != st_map_.end()) {
     st = it->second;
   } else {
     if (load_symbols) {
+      common::StatsTimer symbols_timer("load symbols", file.c_str(), 0);
       BFDInfo *bfd_info = NULL;
-      if (load_vaddr != 0) { // means executable file
+      if (is_exe || meta->is_exec_) {
         string symbol_file = CONF.symbol_path ?: file;
         string debuginfo_file = CONF.debuginfo_path ?: file;
         bfd_info =  new BFDInfo(symbol_file, debuginfo_file);
       } else {
-        bfd_info =  new BFDInfo(file, file);
+        string debuginfo_file = file;
+        if (!meta->has_debug_info()) {
+          string separate = find_separate_debug_file(*meta);
+          if (!separate.empty()) {
+            LOG(DEBUG, "use separate debuginfo, file: %s, debuginfo: %s", file.c_str(), separate.c_str());
+            debuginfo_file = separate;
+          }
+        }
+        bfd_info =  new BFDInfo(file, debuginfo_file);
       }
       if (!bfd_info->init()) return nullptr;
       st = new SymbolTable();
       st->bfd_info_ = bfd_info;
       bfd_info->load_symbols(st);
+      symbols_timer.set_items(st->sym_ents_.size());
+      if (CONF.mem_limit > 0) {
+        st->text_section_ = nullptr;
+        bfd_info->release();
+      }
     }
     st_map_.insert({file, st});
   }
@@ -304,6 +300,37 @@ PTLoad *BFDCache::create_new_pt_load(string &file, void *addr_start, void *addr_
   return pt_load;
 }
 
+SymbolTable *BFDCache::create_synthetic_st(const string &file, std::vector<SymbolEnt> &&sym_ents)
+{
+  string name = file;
+  string no_debug_file;
+  auto *bfd_info = new BFDInfo(name, no_debug_file);
+  bfd_info->meta_ = nullptr;
+  bfd_info->abfd_ = nullptr;
+  bfd_info->syms_ = nullptr;
+  auto *st = new SymbolTable();
+  st->text_section_ = nullptr;
+  st->bfd_info_ = bfd_info;
+  st->sym_ents_ = std::move(sym_ents);
+  std::stable_sort(st->sym_ents_.begin(), st->sym_ents_.end(), [](const SymbolEnt &l, const SymbolEnt &r) {
+                                                          return l.addr_ < r.addr_;
+                                                        });
+  st_map_.insert({file, st});
+  return st;
+}
+
+PTLoad *BFDCache::create_synthetic_pt_load(SymbolTable *st, ulong addr_start, ulong addr_end)
+{
+  // load_vaddr == addr_start makes addr2offset() an identity
+  auto *pt_load = new PTLoad{.addr_start_ = addr_start,
+                             .addr_end_ = addr_end,
+                             .is_exe_ = false,
+                             .st_ = st,
+                             .load_vaddr_ = addr_start};
+  pt_loads_.push_back(pt_load);
+  return pt_load;
+}
+
 void BFDCache::sort_pt_load()
 {
   std::sort(pt_loads_.begin(), pt_loads_.end(),
@@ -311,13 +338,63 @@ void BFDCache::sort_pt_load()
               { return l->addr_start_ < r->addr_start_; });
 }
 
+void BFDCache::remove_pt_loads(ulong start, ulong end)
+{
+  auto it = std::remove_if(pt_loads_.begin(), pt_loads_.end(), [&](PTLoad *pt_load) {
+                                                                 bool in = pt_load->addr_start_ >= start &&
+                                                                   pt_load->addr_end_ <= end;
+                                                                 if (in) delete pt_load;
+                                                                 return in;
+                                                               });
+  pt_loads_.erase(it, pt_loads_.end());
+  free_forgotten();
+  for (auto it = loc_cache_.begin(); it != loc_cache_.end();) {
+    if ((ulong)it->first >= start && (ulong)it->first < end) {
+      it = loc_cache_.erase(it);
+    } else {
+      it++;
+    }
+  }
+}
+
+void BFDCache::forget_symbols(const string &file)
+{
+  SymbolTable *st = nullptr;
+  auto it = st_map_.find(file);
+  if (it != st_map_.end()) {
+    st = it->second;
+    st_map_.erase(it);
+  }
+  // an old copy of the file may still be mapped somewhere else
+  forgotten_.push_back({st, ELF_META.detach(file)});
+  free_forgotten();
+}
+
+void BFDCache::free_forgotten()
+{
+  for (auto it = forgotten_.begin(); it != forgotten_.end();) {
+    SymbolTable *st = it->first;
+    if (st && std::any_of(pt_loads_.begin(), pt_loads_.end(), [&](PTLoad *pt_load) { return pt_load->st_ == st; })) {
+      it++;
+      continue;
+    }
+    if (st) {
+      st->bfd_info_->release();
+      delete st->bfd_info_;
+      delete st;
+    }
+    ElfMetaCache::destroy(it->second);
+    it = forgotten_.erase(it);
+  }
+}
+
 PTLoad *BFDCache::find_pt_load(ulong addr)
 {
   PTLoad *pt_load = nullptr;
   auto pt_it = std::upper_bound(pt_loads_.begin(), pt_loads_.end(),
                                 (ulong)addr, [](ulong addr, PTLoad *l) {
                                              return addr < l->addr_end_; });
-  if (pt_it != pt_loads_.end()) {
+  if (pt_it != pt_loads_.end() && in_range(addr, *pt_it)) {
     pt_load = *pt_it;
   }
   return pt_load;
@@ -20,6 +20,9 @@
 
 #include <unordered_map>
 #include "config.h"
+#include "elf_meta.h"
+#include "location.h"
+#include "lib/string_pool.h"
 #include <vector>
 #include <string>
 #include <bfd.h>
@@ -33,6 +36,7 @@ struct SymbolEnt
 {
   ulong addr_;
   std::string name_;
+  const char *demangled_; // lazily filled by the first lookup
 };
 
 struct BFDInfo;
@@ -42,6 +46,7 @@ struct SymbolTable
   ulong text_vma;
   ulong text_size;
   std::vector<SymbolEnt> sym_ents_;
+  std::vector<SymbolEnt> data_ents_; // objects, with --futex only
   BFDInfo *bfd_info_;
 };
 
@@ -49,12 +54,15 @@ struct BFDInfo
 {
   string file_;
   string debug_file_;
+  ElfMeta *meta_;
   bfd *abfd_;
   asymbol **syms_;
   SymbolTable st_;
   BFDInfo(string &file, string &debug_file) : file_(file), debug_file_(debug_file) {}
-  bfd *init();
+  bool init();
   SymbolTable *load_symbols(SymbolTable *st);
+  // close the bfd once the symbols are copied out, see --mem-limit
+  void release();
 };
 
 struct PTLoad
@@ -66,51 +74,47 @@ struct PTLoad
   ulong load_vaddr_;
 };
 
-struct Location
-{
-  string file_;
-  string function_;
-  string filename_;
-  unsigned int line_;
-};
-
-struct BContext
-{
-  typedef void (*Func) (void*, const char *file, const char *function,
-                      const char *filename, int line);
-  Func func_;
-  void *arg_;
-};
-
 class BFDCache
 {
 public:
   BFDCache();
   PTLoad *create_new_pt_load(string &file, void *vaddr_start, void *vaddr_end, bool is_exe, bool load_symbols);
+  // symbol table of absolute addresses without an ELF file behind it, e.g. JIT code
+  SymbolTable *create_synthetic_st(const string &file, std::vector<SymbolEnt> &&sym_ents);
+  PTLoad *create_synthetic_pt_load(SymbolTable *st, ulong addr_start, ulong addr_end);
   void sort_pt_load();
+  // unmapped since loaded, e.g. dlclose: drop the pt loads within [start, end) and their cached locations
+  void remove_pt_loads(ulong start, ulong end);
+  // replaced on disk: load the symbols and ElfMeta of file again on the next
+  // create_new_pt_load, the old ones are freed with the last pt load using them
+  void forget_symbols(const string &file);
+  // file and function of addr, cached; filename and line are left unknown
+  const Location &addr2location(void *addr);
   template<typename func>
   void addr2symbol(void *addr, func &&f)
   {
-    BContext bctx;
-    bctx.func_ = [](void *arg, const char *file, const char *function,
-                    const char *filename, int line) {
-                   (*(func*)arg)(file, function, filename, line);
-                 };
-    bctx.arg_ = &f;
-    do_addr2symbol(bctx, addr);
+    auto &loc = addr2location(addr);
+    f(strings_.str(loc.file_), strings_.str(loc.function_), strings_.str(loc.filename_), loc.line_);
   }
+  lib::StringPool &strings() { return strings_; }
+  const lib::StringPool &strings() const { return strings_; }
   PTLoad *find_pt_load(ulong addr);
+  int hit_count() const { return hit; }
+  // "name+0xoff" of the data symbol at or below a link-time address, empty if none
+  static string data_symbol(SymbolTable *st, ulong offset);
   static ulong addr2offset(PTLoad *pt_load, ulong addr)
   {
     return (ulong)addr - (pt_load->addr_start_ - pt_load->load_vaddr_);
   }
 private:
-  void do_addr2symbol(BContext &bctx, void *addr);
-private:
+  lib::StringPool strings_;
   std::unordered_map<string, SymbolTable*> st_map_;
   std::unordered_map<string, BFDInfo*> object_map_;
   std::unordered_map<void*, Location> loc_cache_;
   std::vector<PTLoad*> pt_loads_;
+  // forgotten while still mapped, with the ElfMeta they were loaded from
+  std::vector<std::pair<SymbolTable*, ElfMeta*>> forgotten_;
+  void free_forgotten();
   int total = 0;
   int hit = 0;
   int lack = 0;
@@ -0,0 +1,223 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "bfd/elf_meta.h"
+
+#include <fcntl.h>
+#include <link.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "common/config.h"
+#include "common/log.h"
+#include "utils/util.h"
+#include "utils/defer.h"
+
+using namespace std;
+
+namespace _obstack
+{
+namespace bfdutils
+{
+#define IN_IMAGE(meta, off, len) ((ulong)(off) + (ulong)(len) <= (meta).size_)
+
+static void parse_build_id(ElfMeta &meta, ulong off, ulong size)
+{
+  ulong end = off + size;
+  while (off + sizeof(ElfW(Nhdr)) <= end && IN_IMAGE(meta, off, sizeof(ElfW(Nhdr)))) {
+    auto *nhdr = (const ElfW(Nhdr)*)(meta.image_ + off);
+    ulong name_off = off + sizeof(ElfW(Nhdr));
+    ulong desc_off = name_off + ((nhdr->n_namesz + 3) & ~3UL);
+    ulong next_off = desc_off + ((nhdr->n_descsz + 3) & ~3UL);
+    if (next_off > end || !IN_IMAGE(meta, desc_off, nhdr->n_descsz)) break;
+    if (NT_GNU_BUILD_ID == nhdr->n_type && 4 == nhdr->n_namesz &&
+        0 == memcmp(meta.image_ + name_off, "GNU", 4)) {
+      static const char hex[] = "0123456789abcdef";
+      const unsigned char *desc = (const unsigned char *)meta.image_ + desc_off;
+      for (uint i = 0; i < nhdr->n_descsz; i++) {
+        meta.build_id_.push_back(hex[desc[i] >> 4]);
+        meta.build_id_.push_back(hex[desc[i] & 0xf]);
+      }
+      break;
+    }
+    off = next_off;
+  }
+}
+
+static bool parse(ElfMeta &meta)
+{
+  if (!IN_IMAGE(meta, 0, sizeof(ElfW(Ehdr)))) return false;
+  auto *ehdr = (const ElfW(Ehdr)*)meta.image_;
+  if (0 != memcmp(ehdr->e_ident, ELFMAG, SELFMAG)) return false;
+  meta.is_exec_ = ET_EXEC == ehdr->e_type;
+
+  if (!IN_IMAGE(meta, ehdr->e_phoff, ehdr->e_phnum * sizeof(ElfW(Phdr)))) return false;
+  auto *phdr = (const ElfW(Phdr)*)(meta.image_ + ehdr->e_phoff);
+  bool has_load = false;
+  for (int i = 0; i < ehdr->e_phnum; i++) {
+    auto &p = phdr[i];
+    if (PT_LOAD == p.p_type) {
+      if (!has_load || p.p_vaddr < meta.load_vaddr_) {
+        meta.load_vaddr_ = p.p_vaddr & ~((ulong)getpagesize() - 1);
+      }
+      has_load = true;
+      meta.segments_.push_back({.offset_ = p.p_offset, .vaddr_ = p.p_vaddr,
+                                .filesz_ = p.p_filesz, .memsz_ = p.p_memsz, .flags_ = p.p_flags});
+    } else if (PT_NOTE == p.p_type && meta.build_id_.empty()) {
+      parse_build_id(meta, p.p_offset, p.p_filesz);
+    }
+  }
+
+  if (0 == ehdr->e_shoff || !IN_IMAGE(meta, ehdr->e_shoff, ehdr->e_shnum * sizeof(ElfW(Shdr)))) {
+    return true;
+  }
+  auto *shdr = (const ElfW(Shdr)*)(meta.image_ + ehdr->e_shoff);
+  const ElfW(Shdr) *strtab = ehdr->e_shstrndx < ehdr->e_shnum ? &shdr[ehdr->e_shstrndx] : nullptr;
+  if (!strtab || !IN_IMAGE(meta, strtab->sh_offset, strtab->sh_size)) return true;
+  for (int i = 0; i < ehdr->e_shnum; i++) {
+    auto &sh = shdr[i];
+    if (SHT_SYMTAB == sh.sh_type) {
+      meta.stripped_ = false;
+    }
+    if (sh.sh_name >= strtab->sh_size) continue;
+    const char *name = meta.image_ + strtab->sh_offset + sh.sh_name;
+    meta.sections_.insert({name, ElfSection{.offset_ = sh.sh_offset, .addr_ = sh.sh_addr, .size_ = sh.sh_size}});
+    if (0 == strncmp(name, ".debug_", 7) || 0 == strncmp(name, ".zdebug_", 8)) {
+      bool compressed = (sh.sh_flags & SHF_COMPRESSED) && IN_IMAGE(meta, sh.sh_offset, sizeof(ElfW(Chdr)));
+      meta.debug_size_ += compressed ? ((const ElfW(Chdr)*)(meta.image_ + sh.sh_offset))->ch_size : sh.sh_size;
+    }
+    if (SHT_NOTE == sh.sh_type && meta.build_id_.empty() && IN_IMAGE(meta, sh.sh_offset, sh.sh_size)) {
+      parse_build_id(meta, sh.sh_offset, sh.sh_size);
+    } else if (0 == strcmp(name, ".gnu_debuglink") && SHT_NOBITS != sh.sh_type &&
+               IN_IMAGE(meta, sh.sh_offset, sh.sh_size)) {
+      meta.debuglink_ = string(meta.image_ + sh.sh_offset, strnlen(meta.image_ + sh.sh_offset, sh.sh_size));
+    }
+  }
+  return true;
+}
+
+int ElfMeta::read(ulong vaddr, void *buf, size_t len) const
+{
+  for (auto &&seg : segments_) {
+    if (vaddr < seg.vaddr_ || vaddr + len > seg.vaddr_ + seg.filesz_) continue;
+    ulong off = seg.offset_ + (vaddr - seg.vaddr_);
+    if (0 != (seg.flags_ & PF_W) || !image_ || off + len > size_) {
+      return -1;
+    }
+    memcpy(buf, image_ + off, len);
+    return 0;
+  }
+  return -1;
+}
+
+ElfMeta *ElfMetaCache::get(const string &file)
+{
+  auto it = metas_.find(file);
+  if (it != metas_.end()) {
+    return it->second;
+  }
+  auto *meta = new ElfMeta();
+  meta->file_ = file;
+  meta->valid_ = false;
+  meta->is_exec_ = false;
+  meta->stripped_ = true;
+  meta->load_vaddr_ = 0;
+  meta->debug_size_ = 0;
+  meta->image_ = nullptr;
+  meta->size_ = 0;
+  meta->inode_ = 0;
+  meta->dev_ = 0;
+  meta->mtime_ns_ = 0;
+  metas_.insert({file, meta});
+
+  int fd = ::open(file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(DEBUG, "open failed, file: %s, errno: %d", file.c_str(), errno);
+    return meta;
+  }
+  DEFER(::close(fd));
+  struct stat sb;
+  if (0 != fstat(fd, &sb) || sb.st_size <= 0) {
+    return meta;
+  }
+  void *image = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (MAP_FAILED == image) {
+    LOG(WARN, "mmap failed, file: %s, errno: %d", file.c_str(), errno);
+    return meta;
+  }
+  meta->image_ = (const char *)image;
+  meta->size_ = sb.st_size;
+  meta->inode_ = sb.st_ino;
+  meta->dev_ = sb.st_dev;
+  meta->mtime_ns_ = sb.st_mtim.tv_sec * 1000000000L + sb.st_mtim.tv_nsec;
+  meta->valid_ = parse(*meta);
+  LOG(DEBUG, "elf meta, file: %s, valid: %d, exec: %d, stripped: %d, load_vaddr: 0x%lx, build_id: %s, debuglink: %s",
+      file.c_str(), meta->valid_, meta->is_exec_, meta->stripped_, meta->load_vaddr_,
+      meta->build_id_.c_str(), meta->debuglink_.c_str());
+  return meta;
+}
+
+ElfMeta *ElfMetaCache::detach(const string &file)
+{
+  auto it = metas_.find(file);
+  if (it == metas_.end()) return nullptr;
+  ElfMeta *meta = it->second;
+  metas_.erase(it);
+  return meta;
+}
+
+void ElfMetaCache::destroy(ElfMeta *meta)
+{
+  if (!meta) return;
+  if (meta->image_) {
+    munmap((void *)meta->image_, meta->size_);
+  }
+  delete meta;
+}
+
+static const char *DEBUG_ROOT = "/usr/lib/debug";
+
+string find_file_by_build_id(const string &build_id)
+{
+  char path[1024];
+  if (build_id.length() > 2) {
+    snprintf(path, sizeof(path), "%s/.build-id/%.2s/%s.debug", DEBUG_ROOT,
+             build_id.c_str(), build_id.c_str() + 2);
+    if (common::file_exist(path)) return path;
+  }
+  return "";
+}
+
+string find_separate_debug_file(const ElfMeta &meta)
+{
+  string path = find_file_by_build_id(meta.build_id_);
+  if (!path.empty()) return path;
+  if (!meta.debuglink_.empty()) {
+    string dir = meta.file_.substr(0, meta.file_.rfind('/') + 1);
+    const string candidates[] = {dir + meta.debuglink_,
+                                 dir + ".debug/" + meta.debuglink_,
+                                 DEBUG_ROOT + dir + meta.debuglink_};
+    for (auto &&candidate : candidates) {
+      if (candidate != meta.file_ && common::file_exist(candidate)) return candidate;
+    }
+  }
+  return "";
+}
+
+}
+}
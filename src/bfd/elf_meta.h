@@ -0,0 +1,106 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ELF_META_H_
+#define ELF_META_H_
+
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <sys/types.h>
+
+namespace _obstack
+{
+namespace bfdutils
+{
+using std::string;
+
+struct ElfSection
+{
+  ulong offset_;
+  ulong addr_;
+  ulong size_;
+};
+
+struct ElfSegment
+{
+  ulong offset_;
+  ulong vaddr_;
+  ulong filesz_;
+  ulong memsz_;
+  uint flags_;
+};
+
+/*
+ * Everything obstack needs to know about one ELF file, parsed once from a
+ * single read-only mapping and shared by all mappings of that file.
+ */
+struct ElfMeta
+{
+  string file_;
+  bool valid_;
+  bool is_exec_;       // ET_EXEC, i.e. not a shared object or PIE
+  bool stripped_;      // no .symtab
+  ulong load_vaddr_;   // p_vaddr of the lowest PT_LOAD
+  string build_id_;    // hex string, empty if absent
+  string debuglink_;   // .gnu_debuglink file name, empty if absent
+  ulong debug_size_;   // of the .debug_* sections, uncompressed
+  std::vector<ElfSegment> segments_;
+  std::unordered_map<string, ElfSection> sections_;
+  const char *image_;
+  size_t size_;
+  ulong inode_;        // of the file parsed, to notice it being replaced
+  ulong dev_;
+  int64_t mtime_ns_;
+  const ElfSection *find_section(const char *name) const
+  {
+    auto it = sections_.find(name);
+    return it == sections_.end() ? nullptr : &it->second;
+  }
+  bool has_debug_info() const { return nullptr != find_section(".debug_info"); }
+  // bytes at a link-time vaddr of a read-only PT_LOAD, -1 if writable or not in the file
+  int read(ulong vaddr, void *buf, size_t len) const;
+};
+
+class ElfMetaCache
+{
+public:
+  static ElfMetaCache &instance()
+  {
+    static ElfMetaCache one;
+    return one;
+  }
+  ElfMeta *get(const string &file);
+  // parse file again on the next get(), e.g. replaced on disk; the old one is
+  // returned to the caller, who frees it with destroy() once unused
+  ElfMeta *detach(const string &file);
+  static void destroy(ElfMeta *meta);
+private:
+  ElfMetaCache() {}
+  std::unordered_map<string, ElfMeta*> metas_;
+};
+
+// separate debuginfo of meta, located by build-id or .gnu_debuglink, empty if none
+string find_separate_debug_file(const ElfMeta &meta);
+// debuginfo installed for a hex build-id, empty if none
+string find_file_by_build_id(const string &build_id);
+}
+}
+
+#define ELF_META (bfdutils::ElfMetaCache::instance())
+
+#endif // ELF_META_H_
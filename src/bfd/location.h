@@ -0,0 +1,38 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef BFD_LOCATION_H_
+#define BFD_LOCATION_H_
+
+#include <stdint.h>
+
+namespace _obstack
+{
+namespace bfdutils
+{
+// symbolized address, the strings are ids in the StringPool of its BFDCache
+struct Location
+{
+  uint32_t file_;
+  uint32_t function_;
+  uint32_t filename_;
+  uint32_t line_; // 0 if filename_ is unknown
+};
+}
+}
+
+#endif // BFD_LOCATION_H_
@@ -23,15 +23,65 @@ DEF_CONF(const char*, symbol_path, nullptr)
 DEF_CONF(const char*, debuginfo_path, nullptr)
 DEF_CONF(bool, no_lineno, false)
 DEF_CONF(bool, thread_only, false)
+DEF_CONF(bool, llvm_demangle, false)
+DEF_CONF(bool, short_name, false)
+DEF_CONF(OutputFormat, format, FORMAT_TEXT)
+DEF_CONF(AggBy, agg_by, AGG_BY_ADDR)
+DEF_CONF(int, agg_top, 0)
+DEF_CONF(const char*, diff_before, nullptr)
+DEF_CONF(const char*, diff_after, nullptr)
+DEF_CONF(const char*, core, nullptr)
+DEF_CONF(const char*, core_exe, nullptr)
+DEF_CONF(const char*, save_raw, nullptr)
+DEF_CONF(bool, symbolize, false)
+DEF_CONF(const char*, pname, nullptr)
+DEF_CONF(bool, merge, false)
+DEF_CONF(bool, stats, false)
+DEF_CONF(int64_t, mem_limit, 0)
+DEF_CONF(int64_t, thread_budget_us, 0)
+DEF_CONF(int64_t, total_budget_us, 0)
+DEF_CONF(CaptureOrder, order, ORDER_TID)
+DEF_CONF(int, order_window_ms, 100)
+DEF_CONF(int, top, 0)
+DEF_CONF(int, top_interval_ms, 1000)
+DEF_CONF(bool, futex, false)
+DEF_CONF(bool, deadlock, false)
+DEF_CONF(bool, agent, false)
+DEF_CONF(int64_t, perf_ms, 0)
+DEF_CONF(int, perf_freq, 99)
+DEF_CONF(bool, perf_dwarf, false)
+DEF_CONF(int, repeat, 1)
+DEF_CONF(int64_t, interval_ms, 1000)
 #endif
 
 #ifndef COMMON_CONFIG_H_
 #define COMMON_CONFIG_H_
 
+#include <stdint.h>
+
 namespace _obstack
 {
 namespace common
 {
+enum OutputFormat
+{
+  FORMAT_TEXT,
+  FORMAT_NDJSON,
+};
+
+enum AggBy
+{
+  AGG_BY_ADDR,
+  AGG_BY_FUNC,
+};
+
+enum CaptureOrder
+{
+  ORDER_TID,   // as listed in /proc/<pid>/task
+  ORDER_CPU,   // most cpu time within a sampling window first
+  ORDER_STATE, // running, then uninterruptible sleep, then the rest
+};
+
 class Config
 {
 public:
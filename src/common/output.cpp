@@ -0,0 +1,76 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common/output.h"
+#include <string.h>
+
+namespace _obstack
+{
+namespace common
+{
+Output::Output()
+  : file_(stdout), buf_(new char[BUF_SIZE]), pos_(0), color_(isatty(fileno(stdout))), stream_(false)
+{
+}
+
+void Output::write(const char *data, int64_t len)
+{
+  if (pos_ + len > BUF_SIZE) {
+    flush();
+  }
+  if (len > BUF_SIZE) {
+    fwrite(data, 1, len, file_);
+  } else {
+    memcpy(buf_ + pos_, data, len);
+    pos_ += len;
+  }
+}
+
+void Output::json_string(const char *s)
+{
+  static const char hex[] = "0123456789abcdef";
+  put('"');
+  for (const unsigned char *p = (const unsigned char *)s; *p; p++) {
+    switch (*p) {
+    case '"': write("\\\"", 2); break;
+    case '\\': write("\\\\", 2); break;
+    case '\n': write("\\n", 2); break;
+    case '\r': write("\\r", 2); break;
+    case '\t': write("\\t", 2); break;
+    default:
+      if (*p < 0x20) {
+        char esc[] = {'\\', 'u', '0', '0', hex[*p >> 4], hex[*p & 0xf]};
+        write(esc, sizeof(esc));
+      } else {
+        put(*p);
+      }
+    }
+  }
+  put('"');
+}
+
+void Output::flush()
+{
+  if (pos_ > 0) {
+    fwrite(buf_, 1, pos_, file_);
+    pos_ = 0;
+  }
+  fflush(file_);
+}
+
+}
+}
@@ -0,0 +1,98 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMMON_OUTPUT_H_
+#define COMMON_OUTPUT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "utils/color_printf.h"
+
+namespace _obstack
+{
+namespace common
+{
+/*
+ * Buffered writer for everything obstack prints to stdout. Color is decided
+ * once, it is only used when stdout is a tty and the output format is text.
+ * NDJSON streams: each thread or group is handed to the reader as soon as
+ * it is complete, text fills the buffer.
+ */
+class Output
+{
+public:
+  static const int64_t BUF_SIZE = 1L << 20;
+  static Output &instance()
+  {
+    static Output one;
+    return one;
+  }
+  ~Output() { flush(); delete [] buf_; }
+  void set_color(bool color) { color_ = color; }
+  void set_stream(bool stream) { stream_ = stream; }
+  template<typename ... Args>
+  void printf(const char *color_fmt, const char *fmt, Args && ... args)
+  {
+    const char *f = color_ ? color_fmt : fmt;
+    int64_t n = snprintf(buf_ + pos_, BUF_SIZE - pos_, f, args...);
+    if (n >= BUF_SIZE - pos_) {
+      flush();
+      n = snprintf(buf_, BUF_SIZE, f, args...);
+      if (n >= BUF_SIZE) {
+        fprintf(file_, f, args...);
+        n = 0;
+      }
+    }
+    if (n > 0) pos_ += n;
+  }
+  template<typename ... Args>
+  void append(const char *fmt, Args && ... args)
+  {
+    printf(fmt, fmt, args...);
+  }
+  void write(const char *data, int64_t len);
+  void put(char c)
+  {
+    if (pos_ >= BUF_SIZE) flush();
+    buf_[pos_++] = c;
+  }
+  // quoted and escaped json string
+  void json_string(const char *s);
+  void flush();
+  // end of a thread or group record
+  void end_record()
+  {
+    if (stream_) flush();
+  }
+private:
+  Output();
+  FILE *file_;
+  char *buf_;
+  int64_t pos_;
+  bool color_;
+  bool stream_;
+};
+}
+}
+
+#define OUTPUT (common::Output::instance())
+
+#define o_printf(color, fmt, args...) \
+  OUTPUT.printf(color fmt COLOR_RESET, fmt, ##args)
+
+#endif  // COMMON_OUTPUT_H_
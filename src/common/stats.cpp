@@ -0,0 +1,82 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common/stats.h"
+#include <stdio.h>
+#include <sys/resource.h>
+#include <algorithm>
+
+namespace _obstack
+{
+namespace common
+{
+static int64_t peak_rss_kb(int who)
+{
+  struct rusage ru;
+  return 0 == getrusage(who, &ru) ? ru.ru_maxrss : 0;
+}
+
+void Stats::add(const char *phase, const char *file, int64_t cost_ns, int64_t items, int64_t hits)
+{
+  if (!CONF.stats) return;
+  std::string key = std::string(phase) + '\0' + file;
+  auto it = idxs_.insert({key, entries_.size()}).first;
+  if (it->second == entries_.size()) {
+    entries_.push_back(Entry{.phase_ = phase, .file_ = file, .calls_ = 0, .cost_ns_ = 0,
+                             .items_ = 0, .hits_ = -1, .peak_rss_kb_ = 0});
+  }
+  auto &entry = entries_[it->second];
+  entry.calls_++;
+  entry.cost_ns_ += cost_ns;
+  entry.items_ += items;
+  if (hits >= 0) {
+    entry.hits_ = std::max<int64_t>(entry.hits_, 0) + hits;
+  }
+  entry.peak_rss_kb_ = peak_rss_kb(RUSAGE_SELF);
+}
+
+void Stats::report()
+{
+  if (!CONF.stats) return;
+  fprintf(stderr, "%-18s %8s %12s %10s %7s %10s  %s\n",
+          "phase", "calls", "cost(ms)", "items", "hit%", "rss(MB)", "file");
+  for (auto &&entry : entries_) {
+    char hit_rate[16] = "-";
+    if (entry.hits_ >= 0 && entry.items_ > 0) {
+      snprintf(hit_rate, sizeof(hit_rate), "%.1f", entry.hits_ * 100.0 / entry.items_);
+    }
+    fprintf(stderr, "%-18s %8ld %12.3f %10ld %7s %10.1f  %s\n",
+            entry.phase_.c_str(), entry.calls_, entry.cost_ns_ / 1e6, entry.items_, hit_rate,
+            entry.peak_rss_kb_ / 1024.0, entry.file_.c_str());
+  }
+  int64_t children_kb = peak_rss_kb(RUSAGE_CHILDREN);
+  fprintf(stderr, "peak rss(MB): %.1f", peak_rss_kb(RUSAGE_SELF) / 1024.0);
+  if (children_kb > 0) {
+    fprintf(stderr, ", coreprocess: %.1f", children_kb / 1024.0);
+  }
+  fprintf(stderr, "\n");
+}
+
+StatsTimer::~StatsTimer()
+{
+  if (CONF.stats) {
+    STATS.add(phase_, file_, Stats::now_ns() - s_ts_, items_, hits_);
+  }
+}
+
+}
+}
@@ -0,0 +1,92 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMMON_STATS_H_
+#define COMMON_STATS_H_
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "common/config.h"
+
+namespace _obstack
+{
+namespace common
+{
+/*
+ * Wall time, item counts and cache hits of the phases of one run, kept per
+ * file where a phase works file by file. Printed to stderr by --stats,
+ * nothing is recorded without it.
+ */
+class Stats
+{
+public:
+  struct Entry
+  {
+    std::string phase_;
+    std::string file_;
+    int64_t calls_;
+    int64_t cost_ns_;
+    int64_t items_;
+    int64_t hits_;        // -1 if the phase has nothing to hit
+    int64_t peak_rss_kb_; // of obstack itself, after the last call
+  };
+  static Stats &instance()
+  {
+    static Stats one;
+    return one;
+  }
+  static int64_t now_ns()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+  }
+  void add(const char *phase, const char *file, int64_t cost_ns, int64_t items, int64_t hits = -1);
+  void report();
+private:
+  Stats() {}
+  std::vector<Entry> entries_; // in order of first appearance
+  std::unordered_map<std::string, size_t> idxs_;
+};
+
+// adds the wall time of its scope to a phase
+class StatsTimer
+{
+public:
+  StatsTimer(const char *phase, const char *file = "", int64_t items = 1)
+    : phase_(phase), file_(file), items_(items), hits_(-1), s_ts_(CONF.stats ? Stats::now_ns() : 0) {}
+  ~StatsTimer();
+  StatsTimer(const StatsTimer &) = delete;
+  StatsTimer &operator=(const StatsTimer &) = delete;
+  void set_items(int64_t items) { items_ = items; }
+  void set_hits(int64_t hits) { hits_ = hits; }
+private:
+  const char *phase_;
+  const char *file_;
+  int64_t items_;
+  int64_t hits_;
+  int64_t s_ts_;
+};
+}
+}
+
+#define STATS (common::Stats::instance())
+
+#endif  // COMMON_STATS_H_
@@ -0,0 +1,124 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "lib/demangle.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#define HAVE_DECL_BASENAME 1
+#include <libiberty/demangle.h>
+#undef HAVE_DECL_BASENAME
+#include "llvm/Demangle/Demangle.h"
+#include "common/config.h"
+
+namespace _obstack
+{
+namespace lib
+{
+using namespace common;
+
+static char *gnu_demangle(const char *symbol)
+{
+  uint arg = DMGL_ANSI;
+  arg |= DMGL_PARAMS;
+  arg |= DMGL_TYPES;
+  return cplus_demangle(symbol, arg);
+}
+
+static char *llvm_demangle(const char *symbol)
+{
+  int status = 0;
+  return llvm::itaniumDemangle(symbol, nullptr, nullptr, &status);
+}
+
+const char *Demangler::demangle(const char *symbol)
+{
+  count_++;
+  char *demangled = CONF.llvm_demangle ? llvm_demangle(symbol) : gnu_demangle(symbol);
+  const char *name = demangled ?: symbol;
+  auto it = CONF.short_name ?
+    names_.insert(simplify_name(name)).first : names_.insert(std::string(name)).first;
+  free(demangled);
+  return it->c_str();
+}
+
+static bool skip_prefix(const char *&p, const char *prefix)
+{
+  size_t len = strlen(prefix);
+  bool match = 0 == strncmp(p, prefix, len);
+  if (match) p += len;
+  return match;
+}
+
+std::string simplify_name(const char *name)
+{
+  static const char *ANONYMOUS_NS = "(anonymous namespace)";
+  static const char *QUALIFIERS[] = {" const", " volatile", " &&", " &"};
+  std::string out;
+  size_t cut = 0;
+  size_t operator_end = std::string::npos;
+  bool stripped_params = false;
+  const char *p = name;
+  while (*p) {
+    const char *start = p;
+    if (skip_prefix(p, ANONYMOUS_NS)) {
+      out.append(start, p - start);
+    } else if ((p == name || !(isalnum(p[-1]) || '_' == p[-1])) && skip_prefix(p, "operator")) {
+      // keep the operator symbol, it may contain '<', '(' or a space
+      if (!skip_prefix(p, "()") && !skip_prefix(p, "[]")) {
+        for (int i = 0; i < 3 && *p && strchr("<>=!+-*/%^&|~,", *p); i++) p++;
+        if (p == start + 8 && ' ' == *p) {
+          p++;
+          while (*p && (isalnum(*p) || '_' == *p || ':' == *p)) p++;
+        }
+      }
+      out.append(start, p - start);
+      operator_end = out.size();
+    } else if ('<' == *p || '(' == *p) {
+      // skip a balanced template argument or parameter list
+      bool params = '(' == *p;
+      int depth = 0;
+      do {
+        if ('<' == *p || '(' == *p) depth++;
+        else if ('>' == *p || ')' == *p) depth--;
+        p++;
+      } while (*p && depth > 0);
+      if (params) {
+        stripped_params = true;
+        bool matched = true;
+        while (matched) {
+          matched = false;
+          for (auto *q : QUALIFIERS) {
+            if (skip_prefix(p, q)) matched = true;
+          }
+        }
+      }
+    } else {
+      if (' ' == *p && !stripped_params && out.size() != operator_end) {
+        // everything before a top-level space is a return type or a prefix
+        // like "virtual thunk to"
+        cut = out.size() + 1;
+      }
+      out.push_back(*p++);
+    }
+  }
+  while (!out.empty() && ' ' == out.back()) out.pop_back();
+  return cut < out.size() ? out.substr(cut) : out;
+}
+
+}
+}
@@ -0,0 +1,53 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_DEMANGLE_H_
+#define LIB_DEMANGLE_H_
+
+#include <unordered_set>
+#include <string>
+
+namespace _obstack
+{
+namespace lib
+{
+class Demangler
+{
+public:
+  static Demangler &instance()
+  {
+    static Demangler one;
+    return one;
+  }
+  // demangled (and optionally simplified) name, interned and alive until exit
+  const char *demangle(const char *symbol);
+  int64_t count() const { return count_; }
+private:
+  Demangler() : count_(0) {}
+  std::unordered_set<std::string> names_;
+  int64_t count_;
+};
+
+// drop template arguments, parameter lists and return types of a demangled name,
+// e.g. "void ns::Foo<int>::bar(int) const" => "ns::Foo::bar"
+std::string simplify_name(const char *name);
+}
+}
+
+#define DEMANGLER (lib::Demangler::instance())
+
+#endif  // LIB_DEMANGLE_H_
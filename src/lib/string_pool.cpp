@@ -0,0 +1,82 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "lib/string_pool.h"
+
+namespace _obstack
+{
+namespace lib
+{
+size_t StringPool::KeyHash::operator()(const Key &key) const
+{
+  // FNV-1a
+  uint64_t h = 0xcbf29ce484222325UL;
+  for (size_t i = 0; i < key.len_; i++) {
+    h = (h ^ (unsigned char)key.s_[i]) * 0x100000001b3UL;
+  }
+  return h;
+}
+
+StringPool::StringPool()
+  : pos_(nullptr), end_(nullptr), mem_used_(0)
+{
+  intern("???");
+}
+
+StringPool::~StringPool()
+{
+  for (auto *block : blocks_) {
+    delete [] block;
+  }
+}
+
+char *StringPool::alloc(size_t size)
+{
+  if (pos_ + size > end_) {
+    // oversized strings get a block of their own, the current one stays open
+    size_t block_size = size > BLOCK_SIZE / 4 ? size : BLOCK_SIZE;
+    char *block = new char[block_size];
+    blocks_.push_back(block);
+    mem_used_ += block_size;
+    if (block_size != BLOCK_SIZE) {
+      return block;
+    }
+    pos_ = block;
+    end_ = block + block_size;
+  }
+  char *p = pos_;
+  pos_ += size;
+  return p;
+}
+
+uint32_t StringPool::intern(const char *s, size_t len)
+{
+  auto it = ids_.find(Key{.s_ = s, .len_ = len});
+  if (it != ids_.end()) {
+    return it->second;
+  }
+  char *p = alloc(len + 1);
+  memcpy(p, s, len);
+  p[len] = '\0';
+  uint32_t id = strs_.size();
+  strs_.push_back(p);
+  ids_.insert({Key{.s_ = p, .len_ = len}, id});
+  return id;
+}
+
+}
+}
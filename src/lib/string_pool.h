@@ -0,0 +1,75 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_STRING_POOL_H_
+#define LIB_STRING_POOL_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <unordered_map>
+
+namespace _obstack
+{
+namespace lib
+{
+/*
+ * Interned strings in an append-only arena, each distinct string is stored
+ * once and named by a dense 32-bit id. Ids and pointers stay valid for the
+ * life of the pool.
+ */
+class StringPool
+{
+public:
+  static const uint32_t UNKNOWN = 0; // "???"
+  StringPool();
+  ~StringPool();
+  StringPool(const StringPool &) = delete;
+  StringPool &operator=(const StringPool &) = delete;
+  uint32_t intern(const char *s) { return intern(s, strlen(s)); }
+  uint32_t intern(const char *s, size_t len);
+  const char *str(uint32_t id) const { return strs_[id]; }
+  size_t size() const { return strs_.size(); }
+  // bytes held by the arena
+  size_t mem_used() const { return mem_used_; }
+private:
+  struct Key
+  {
+    const char *s_;
+    size_t len_;
+    bool operator==(const Key &other) const
+    {
+      return len_ == other.len_ && 0 == memcmp(s_, other.s_, len_);
+    }
+  };
+  struct KeyHash
+  {
+    size_t operator()(const Key &key) const;
+  };
+  static const size_t BLOCK_SIZE = 64 << 10;
+  char *alloc(size_t size);
+  std::vector<char*> blocks_;
+  char *pos_;
+  char *end_;
+  size_t mem_used_;
+  std::vector<const char*> strs_;
+  std::unordered_map<Key, uint32_t, KeyHash> ids_;
+};
+}
+}
+
+#endif  // LIB_STRING_POOL_H_
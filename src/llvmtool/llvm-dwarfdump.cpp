@@ -34,7 +34,9 @@
 #include "llvm/Support/raw_ostream.h"
 #include <setjmp.h>
 #include "lib/signal.h"
+#include "common/config.h"
 #include "common/log.h"
+#include "common/stats.h"
 #include "utils/defer.h"
 
 namespace _obstack
@@ -71,16 +73,35 @@ struct FuncData
 using HandlerFn = std::function<bool(ObjectFile &, DWARFContext &DICtx, Twine,
                                      raw_ostream &, void *)>;
 
-static bool lookup(DWARFContext &DICtx, uint64_t Address, raw_ostream &OS, _obstack::LineInfo *line_info) {
-  auto DIEsForAddr = DICtx.getDIEsForAddress(Address);
-
-  if (!DIEsForAddr)
+// getLineInfoForAddress() walks the inlined chain of the address, which
+// extracts every DIE of its CU; under --mem-limit the CU is found through
+// the aranges or its unit DIE and only its line table is parsed
+static bool lookup_line_table(DWARFContext &DICtx, object::SectionedAddress saddress,
+                              const DILineInfoSpecifier &dis, _obstack::LineInfo *line_info) {
+  DWARFCompileUnit *CU = DICtx.getCompileUnitForAddress(saddress.Address);
+  if (!CU)
+    return false;
+  const DWARFDebugLine::LineTable *LineTable = DICtx.getLineTableForUnit(CU);
+  DILineInfo LineInfo;
+  if (!LineTable ||
+      !LineTable->getFileLineInfoForAddress(saddress, CU->getCompilationDir(), dis.FLIKind, LineInfo))
     return false;
+  line_info->filename_ = LineInfo.FileName;
+  line_info->line_ = LineInfo.Line;
+  return true;
+}
 
+static bool lookup(DWARFContext &DICtx, uint64_t Address, raw_ostream &OS, _obstack::LineInfo *line_info) {
   object::SectionedAddress saddress;
   saddress.Address = Address;
 
   DILineInfoSpecifier dis{.FLIKind = DILineInfoSpecifier::FileLineInfoKind::AbsoluteFilePath, .FNKind = DINameKind::None};
+  if (CONF.mem_limit > 0)
+    return lookup_line_table(DICtx, saddress, dis, line_info);
+
+  if (!DICtx.getDIEsForAddress(Address))
+    return false;
+
   if (DILineInfo LineInfo = DICtx.getLineInfoForAddress(saddress, dis)) {
     line_info->filename_ = LineInfo.FileName;
     line_info->line_ = LineInfo.Line;
@@ -98,11 +119,16 @@ static bool dumpObjectFile(ObjectFile &Obj, DWARFContext &DICtx, Twine Filename,
   auto &line_infos = *((FuncData*)arg)->line_infos_;
   auto handler_bak = lib::tl_signal_handler;
   DEFER(lib::tl_signal_handler = handler_bak);
+  std::string file = Filename.str();
+  common::StatsTimer timer("dwarf lookup", file.c_str(), addrs.size());
+  // kept in memory, a fault siglongjmp()s back into the loop below
+  volatile int64_t resolved = 0;
+  DEFER(timer.set_hits(resolved));
   for (int i = 0; i < addrs.size(); i++) {
     int js = sigsetjmp(jmp, 1);
     if (0 == js) {
       lib::tl_signal_handler = fault_tolerant_handler;
-      lookup(DICtx, addrs[i], OS, &line_infos[i]);
+      resolved += lookup(DICtx, addrs[i], OS, &line_infos[i]);
     } else if (1 == js) {
       LOG(DEBUG, "llvm lookup failed, address: %lu", addrs[i]);
     } else {
@@ -139,7 +165,12 @@ static bool handleBuffer(StringRef Filename, MemoryBufferRef Buffer,
 
   bool Result = true;
   if (auto *Obj = dyn_cast<ObjectFile>(BinOrErr->get())) {
-    std::unique_ptr<DWARFContext> DICtx = DWARFContext::create(*Obj);
+    std::string file = Filename.str();
+    std::unique_ptr<DWARFContext> DICtx;
+    {
+      common::StatsTimer timer("dwarf context", file.c_str());
+      DICtx = DWARFContext::create(*Obj);
+    }
     Result = HandleObj(*Obj, *DICtx, Filename, OS, arg);
   }
   else if (auto *Fat = dyn_cast<MachOUniversalBinary>(BinOrErr->get()))
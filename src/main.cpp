@@ -23,29 +23,73 @@
 #include <getopt.h>
 #include <signal.h>
 #include <dirent.h>
+#include <fnmatch.h>
 #include <thread>
+#include <unordered_map>
+#include <memory>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/ptrace.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <elf.h>
 #include <libunwind.h>
 #include <libunwind-ptrace.h>
 #include "lib/macro_utils.h"
 #include "lib/signal.h"
 #include "common/config.h"
+#include "common/stats.h"
 #include "common/log.h"
 #include "common/error.h"
 #include "utils/util.h"
 #include "utils/defer.h"
-#include "utils/color_printf.h"
+#include "common/output.h"
 #include "obstack.h"
+#include "unwind/raw_snapshot.h"
+#include "unwind/file_memory.h"
+#include "agent/client.h"
 
 using namespace std;
 using namespace _obstack;
 using namespace _obstack::common;
 
+// long options without a short form
+enum
+{
+  OPT_LONG_ONLY = 256,
+  OPT_DEMANGLER,
+  OPT_SHORT_NAME,
+  OPT_FORMAT,
+  OPT_AGG_BY,
+  OPT_AGG_TOP,
+  OPT_DIFF,
+  OPT_CORE,
+  OPT_SAVE_RAW,
+  OPT_LOAD_RAW,
+  OPT_PNAME,
+  OPT_MERGE,
+  OPT_STATS,
+  OPT_MEM_LIMIT,
+  OPT_THREAD_BUDGET,
+  OPT_TOTAL_BUDGET,
+  OPT_ORDER,
+  OPT_ORDER_WINDOW,
+  OPT_TOP,
+  OPT_TOP_INTERVAL,
+  OPT_FUTEX,
+  OPT_DEADLOCK,
+  OPT_AGENT,
+  OPT_PERF,
+  OPT_PERF_FREQ,
+  OPT_PERF_DWARF,
+  OPT_REPEAT,
+  OPT_INTERVAL,
+};
+
 struct option long_options[] = {
   {"?", no_argument, nullptr, '?'},
   {"help", no_argument, nullptr, 'h'},
@@ -58,6 +102,42 @@ struct option long_options[] = {
   {"debuginfo_path", required_argument, nullptr, 'd'},
   {"no_lineno", no_argument, nullptr, 'o'},
   {"version", no_argument, nullptr, 'v'},
+  {"demangler", required_argument, nullptr, OPT_DEMANGLER},
+  {"short_name", no_argument, nullptr, OPT_SHORT_NAME},
+  {"format", required_argument, nullptr, OPT_FORMAT},
+  {"agg_by", required_argument, nullptr, OPT_AGG_BY},
+  {"agg_top", required_argument, nullptr, OPT_AGG_TOP},
+  {"diff", required_argument, nullptr, OPT_DIFF},
+  {"core", required_argument, nullptr, OPT_CORE},
+  {"save_raw", required_argument, nullptr, OPT_SAVE_RAW},
+  {"save-raw", required_argument, nullptr, OPT_SAVE_RAW},
+  {"load_raw", required_argument, nullptr, OPT_LOAD_RAW},
+  {"load-raw", required_argument, nullptr, OPT_LOAD_RAW},
+  {"pname", required_argument, nullptr, OPT_PNAME},
+  {"merge", no_argument, nullptr, OPT_MERGE},
+  {"stats", no_argument, nullptr, OPT_STATS},
+  {"mem_limit", required_argument, nullptr, OPT_MEM_LIMIT},
+  {"mem-limit", required_argument, nullptr, OPT_MEM_LIMIT},
+  {"thread_budget", required_argument, nullptr, OPT_THREAD_BUDGET},
+  {"thread-budget", required_argument, nullptr, OPT_THREAD_BUDGET},
+  {"total_budget", required_argument, nullptr, OPT_TOTAL_BUDGET},
+  {"total-budget", required_argument, nullptr, OPT_TOTAL_BUDGET},
+  {"order", required_argument, nullptr, OPT_ORDER},
+  {"order_window", required_argument, nullptr, OPT_ORDER_WINDOW},
+  {"order-window", required_argument, nullptr, OPT_ORDER_WINDOW},
+  {"top", required_argument, nullptr, OPT_TOP},
+  {"top_interval", required_argument, nullptr, OPT_TOP_INTERVAL},
+  {"top-interval", required_argument, nullptr, OPT_TOP_INTERVAL},
+  {"futex", no_argument, nullptr, OPT_FUTEX},
+  {"deadlock", no_argument, nullptr, OPT_DEADLOCK},
+  {"agent", no_argument, nullptr, OPT_AGENT},
+  {"perf", required_argument, nullptr, OPT_PERF},
+  {"perf_freq", required_argument, nullptr, OPT_PERF_FREQ},
+  {"perf-freq", required_argument, nullptr, OPT_PERF_FREQ},
+  {"perf_dwarf", no_argument, nullptr, OPT_PERF_DWARF},
+  {"perf-dwarf", no_argument, nullptr, OPT_PERF_DWARF},
+  {"repeat", required_argument, nullptr, OPT_REPEAT},
+  {"interval", required_argument, nullptr, OPT_INTERVAL},
   {nullptr, 0, nullptr, 0}};
 
 static void show_version()
@@ -70,21 +150,76 @@ static void show_version()
 
 static void usage_exit() {
   printf("Usage: \n");
-  printf(" obstack [option(s)] [pid]\n\n");
+  printf(" obstack [option(s)] [pid ...]\n");
+  printf(" obstack [option(s)] --pname=pattern\n");
+  printf(" obstack [option(s)] --diff before.dump after.dump\n");
+  printf(" obstack [option(s)] --core core.file [executable]\n");
+  printf(" obstack --save_raw raw.file $pid; obstack [option(s)] --load_raw raw.file\n");
+  printf(" obstack [option(s)] symbolize 1.dump [2.dump ...]\n\n");
   printf("Example: \n");
-  printf(" obstack $pid\n\n");
+  printf(" obstack $pid\n");
+  printf(" obstack -n $pid > before.dump; obstack -n $pid > after.dump; obstack --diff before.dump after.dump\n\n");
   printf("Options: \n");
   printf(" -l, --log_level=[DEBUG|INFO|WARN|ERROR]              : Log level\n");
-  printf(" -n, --no_parse                                       : Output address only\n");
+  printf(" -n, --no_parse                                       : Output module build-id and offset only\n");
   printf(" -a, --agg                                            : Aggregate backtrace\n");
   printf(" -s, --symbol_path=path                               : Binary path\n");
   printf(" -d, --debuginfo_path=path                            : Debuginfo path\n");
   printf(" -o, --no_lineno                                      : Output function name only\n");
   printf(" -t, --thread_only                                    : Process single thread only\n");
   printf(" -v, --version                                        : Output version number\n");
+  printf("     --demangler=[gnu|llvm]                           : Demangler backend, default gnu\n");
+  printf("     --short_name                                     : Drop template and parameter lists of function names\n");
+  printf("     --format=[text|ndjson]                           : Output format, ndjson emits one object per thread or group\n");
+  printf("     --agg_by=[addr|func]                             : Aggregate by return addresses or by function names, implies -a\n");
+  printf("     --agg_top=N                                      : Aggregate by the top N frames only, implies -a\n");
+  printf("     --diff=before.dump after.dump                    : Compare two --no_parse dumps\n");
+  printf("     --core=core.file [executable]                    : Unwind the threads of a core file, executable defaults to the one recorded\n");
+  printf("     --save_raw=raw.file                              : Save registers, stack bytes, maps and build-ids only, no unwinding\n");
+  printf("     --load_raw=raw.file [executable]                 : Unwind and symbolize a file saved by --save_raw\n");
+  printf("     --pname=pattern                                  : Capture every process whose name matches the glob pattern\n");
+  printf("     --merge                                          : Print the threads of several processes together, default per pid\n");
+  printf("     --stats                                          : Print time, items, cache hits and peak RSS of each phase to stderr\n");
+  printf("     --mem_limit=SIZE[K|M|G]                          : Read debuginfo file by file, without line numbers past this RSS\n");
+  printf("     --thread_budget=MS                               : Pause a thread at most MS, a longer stack is cut short\n");
+  printf("     --total_budget=MS                                : Stop capturing after MS, the remaining threads are skipped\n");
+  printf("     --order=[tid|cpu|state]                          : Capture order within a process, busiest or running/blocked threads first\n");
+  printf("     --order_window=MS                                : Window of cpu time sampling for --order=cpu, default 100\n");
+  printf("     --top=K                                          : Capture the K threads using the most cpu only, print cpu%% and run queue delay\n");
+  printf("     --top_interval=MS                                : Window of cpu and run queue delay sampling for --top, default 1000\n");
+  printf("     --futex                                          : Group threads by the futex they wait on, named by data symbol\n");
+  printf("     --deadlock                                       : Find lock holders and wait-for cycles from pthread mutex/rwlock owners, implies --futex\n");
+  printf("     --agent                                          : Capture through libobstack_agent.so loaded in the target, no ptrace\n");
+  printf("     --perf=MS                                        : Sample running threads with perf events for MS instead of stopping them, implies -a unless it falls back to ptrace\n");
+  printf("     --perf_freq=HZ                                   : Samples per second of each thread for --perf, default 99\n");
+  printf("     --perf_dwarf                                     : Unwind --perf samples from copied stacks, default kernel frame pointer callchains\n");
+  printf("     --repeat=N                                       : Capture N rounds, modules and symbols are kept between rounds\n");
+  printf("     --interval=MS                                    : Pause between rounds of --repeat, default 1000\n");
   exit(1);
 }
 
+static vector<int> pids;
+
+void get_th_name(int tid, char *buf, int64_t len);
+
+static void find_pids(const char *pattern, vector<int> &matched)
+{
+  DIR *dir = opendir("/proc");
+  if (!dir) return;
+  DEFER(closedir(dir));
+  struct dirent *dirent = nullptr;
+  while ((dirent = readdir(dir))) {
+    int pid = atoi(dirent->d_name);
+    if (pid <= 0 || pid == getpid()) continue;
+    char name[32] = {};
+    get_th_name(pid, name, sizeof(name));
+    if (0 == fnmatch(pattern, common::trim(name), 0)) {
+      matched.push_back(pid);
+      LOG(INFO, "pid matched, pid: %d, name: %s", pid, name);
+    }
+  }
+}
+
 static void get_options(int argc, char** argv) {
   int c;
   while ((c = getopt_long(
@@ -130,15 +265,216 @@ static void get_options(int argc, char** argv) {
       CONF.thread_only = true;
       break;
     }
+    case OPT_DEMANGLER: {
+      if (0 == strcasecmp(optarg, "llvm")) {
+        CONF.llvm_demangle = true;
+      } else if (0 == strcasecmp(optarg, "gnu")) {
+        CONF.llvm_demangle = false;
+      } else {
+        usage_exit();
+      }
+      break;
+    }
+    case OPT_SHORT_NAME: {
+      CONF.short_name = true;
+      break;
+    }
+    case OPT_AGG_BY: {
+      if (0 == strcasecmp(optarg, "func")) {
+        CONF.agg_by = common::AGG_BY_FUNC;
+      } else if (0 == strcasecmp(optarg, "addr")) {
+        CONF.agg_by = common::AGG_BY_ADDR;
+      } else {
+        usage_exit();
+      }
+      CONF.agg = true;
+      break;
+    }
+    case OPT_AGG_TOP: {
+      CONF.agg_top = atoi(optarg);
+      if (CONF.agg_top <= 0) {
+        usage_exit();
+      }
+      CONF.agg = true;
+      break;
+    }
+    case OPT_DIFF: {
+      CONF.diff_before = optarg;
+      break;
+    }
+    case OPT_CORE:
+    case OPT_LOAD_RAW: {
+      // a raw snapshot is a core file
+      CONF.core = optarg;
+      break;
+    }
+    case OPT_PNAME: {
+      CONF.pname = optarg;
+      break;
+    }
+    case OPT_MERGE: {
+      CONF.merge = true;
+      break;
+    }
+    case OPT_STATS: {
+      CONF.stats = true;
+      break;
+    }
+    case OPT_MEM_LIMIT: {
+      char *end = nullptr;
+      CONF.mem_limit = strtol(optarg, &end, 10);
+      if (end == optarg || ('\0' != *end && ('\0' != end[1] || !strchr("KMG", toupper(*end))))) {
+        usage_exit();
+      }
+      switch (toupper(*end)) {
+        case 'G': CONF.mem_limit <<= 10; /* fall through */
+        case 'M': CONF.mem_limit <<= 10; /* fall through */
+        case 'K': CONF.mem_limit <<= 10;
+      }
+      if (CONF.mem_limit <= 0) {
+        usage_exit();
+      }
+      break;
+    }
+    case OPT_THREAD_BUDGET:
+    case OPT_TOTAL_BUDGET: {
+      int64_t budget_us = atol(optarg) * 1000;
+      if (budget_us <= 0) {
+        usage_exit();
+      }
+      (OPT_THREAD_BUDGET == c ? CONF.thread_budget_us : CONF.total_budget_us) = budget_us;
+      break;
+    }
+    case OPT_SAVE_RAW: {
+      CONF.save_raw = optarg;
+      break;
+    }
+    case OPT_ORDER: {
+      if (0 == strcasecmp(optarg, "cpu")) {
+        CONF.order = common::ORDER_CPU;
+      } else if (0 == strcasecmp(optarg, "state")) {
+        CONF.order = common::ORDER_STATE;
+      } else if (0 == strcasecmp(optarg, "tid")) {
+        CONF.order = common::ORDER_TID;
+      } else {
+        usage_exit();
+      }
+      break;
+    }
+    case OPT_ORDER_WINDOW: {
+      CONF.order_window_ms = atoi(optarg);
+      if (CONF.order_window_ms <= 0) {
+        usage_exit();
+      }
+      break;
+    }
+    case OPT_FUTEX: {
+      CONF.futex = true;
+      break;
+    }
+    case OPT_DEADLOCK: {
+      CONF.deadlock = true;
+      CONF.futex = true;
+      break;
+    }
+    case OPT_AGENT: {
+      CONF.agent = true;
+      break;
+    }
+    case OPT_PERF: {
+      CONF.perf_ms = atol(optarg);
+      break;
+    }
+    case OPT_PERF_FREQ: {
+      CONF.perf_freq = atoi(optarg);
+      break;
+    }
+    case OPT_PERF_DWARF: {
+      CONF.perf_dwarf = true;
+      break;
+    }
+    case OPT_REPEAT: {
+      CONF.repeat = std::max(1, atoi(optarg));
+      break;
+    }
+    case OPT_INTERVAL: {
+      char *end = nullptr;
+      CONF.interval_ms = strtol(optarg, &end, 10);
+      if (end == optarg || '\0' != *end || CONF.interval_ms < 0) {
+        usage_exit();
+      }
+      break;
+    }
+    case OPT_TOP: {
+      CONF.top = atoi(optarg);
+      if (CONF.top <= 0) {
+        usage_exit();
+      }
+      break;
+    }
+    case OPT_TOP_INTERVAL: {
+      CONF.top_interval_ms = atoi(optarg);
+      if (CONF.top_interval_ms <= 0) {
+        usage_exit();
+      }
+      break;
+    }
+    case OPT_FORMAT: {
+      if (0 == strcasecmp(optarg, "ndjson")) {
+        CONF.format = common::FORMAT_NDJSON;
+        OUTPUT.set_color(false);
+        OUTPUT.set_stream(true);
+      } else if (0 == strcasecmp(optarg, "text")) {
+        CONF.format = common::FORMAT_TEXT;
+      } else {
+        usage_exit();
+      }
+      break;
+    }
     default: {
       usage_exit();
       break;
     }
     }
   }
-  if (argc > optind) {
-    CONF.pid = atoi(argv[optind]);
-    LOG(INFO, "input pid: %d", CONF.pid);
+  if (CONF.symbolize) {
+    if (argc <= optind) {
+      usage_exit();
+    }
+  } else if (CONF.diff_before) {
+    if (argc <= optind) {
+      usage_exit();
+    }
+    CONF.diff_after = argv[optind];
+  } else if (CONF.core) {
+    if (argc > optind) {
+      CONF.core_exe = argv[optind];
+    }
+  } else {
+    for (int i = optind; i < argc; i++) {
+      pids.push_back(atoi(argv[i]));
+      LOG(INFO, "input pid: %d", pids.back());
+    }
+    if (CONF.pname) {
+      find_pids(CONF.pname, pids);
+    }
+    if (pids.size() > 1 && CONF.save_raw) {
+      LOG(ERROR, "--save_raw takes a single pid");
+      usage_exit();
+    }
+    if (CONF.perf_ms > 0 && (pids.size() > 1 || CONF.save_raw)) {
+      LOG(ERROR, "--perf takes a single pid and saves nothing raw");
+      usage_exit();
+    }
+    if (CONF.repeat > 1 && CONF.save_raw) {
+      LOG(ERROR, "--save_raw writes a single round");
+      usage_exit();
+    }
+    if (CONF.agent && CONF.save_raw) {
+      LOG(ERROR, "--agent unwinds in the target, nothing raw to save");
+      usage_exit();
+    }
+    CONF.pid = pids.empty() ? -1 : pids[0];
   }
 }
 
@@ -221,18 +557,376 @@ void iter_task(int pid, task_cb cb, bool thread_only)
   }
 }
 
+// why a thread has no or a partial stack under --thread_budget/--total_budget
+enum Cut
+{
+  CUT_NONE,
+  CUT_TRUNCATED,   // unwinding ran out of the thread budget
+  CUT_NOT_STOPPED, // did not stop within the thread budget
+  CUT_SKIPPED,     // the total budget was spent before its turn
+  CUT_MAX,
+};
+
 struct Task
 {
   Task()
-    : n_addrs_(0) {}
-  bool is_valid() const { return n_addrs_ > 0; }
+    : n_addrs_(0), pause_us_(0), cut_(CUT_NONE), state_('?'), cpu_ticks_(0), run_delay_ns_(0),
+      futex_(0), lock_owner_(0), has_regs_(false), stack_(nullptr), stack_start_(0), stack_len_(0) {}
+  // registers alone are worth saving, the stack read may come back empty
+  bool is_valid() const { return n_addrs_ > 0 || has_regs_; }
+  // a thread that missed its budget has no stack, but may still have stopped late
+  bool was_paused() const { return is_valid() || (CUT_NOT_STOPPED == cut_ && pause_us_ > 0); }
+  int pid_;
   int tid_;
   char tname_[32];
   ulong addrs_[256];
   int64_t n_addrs_;
-  char bt_[2048];
+  int64_t pause_us_;
+  Cut cut_;
+  /* --order and --top only */
+  char state_;
+  int64_t cpu_ticks_; // utime + stime within the sampling window
+  int64_t run_delay_ns_;
+  /* --futex only */
+  ulong futex_; // address waited on, 0 if none
+  int lock_owner_; // --deadlock only, tid holding the lock behind futex_, 0 if unknown
+  /* --save_raw only */
+  bool has_regs_;
+  unwind::Regs regs_;
+  char *stack_;
+  ulong stack_start_;
+  int64_t stack_len_;
 };
 
+void log_pause_distribution(const vector<Task*> &tasks)
+{
+  vector<int64_t> pauses;
+  for (auto t : tasks) {
+    if (t->was_paused()) pauses.push_back(t->pause_us_);
+  }
+  if (pauses.empty()) return;
+  std::sort(pauses.begin(), pauses.end());
+  auto percentile = [&](int p) { return pauses[(pauses.size() - 1) * p / 100]; };
+  LOG(INFO, "thread pause(us), threads: %ld, p50: %ld, p90: %ld, p99: %ld, max: %ld",
+      pauses.size(), percentile(50), percentile(90), percentile(99), pauses.back());
+}
+
+// futex address the thread sleeps on from /proc/<tid>/syscall, 0 if not in a futex wait
+static ulong read_futex_wait(int pid, int tid)
+{
+  char file[128];
+  snprintf(file, sizeof(file), "/proc/%d/task/%d/syscall", pid, tid);
+  FILE *fp = fopen(file, "rt");
+  if (!fp) return 0;
+  DEFER(fclose(fp));
+  long nr = -1;
+  ulong uaddr = 0, op = 0;
+  if (3 != fscanf(fp, "%ld %lx %lx", &nr, &uaddr, &op) || SYS_futex != nr) {
+    return 0;
+  }
+  switch (op & FUTEX_CMD_MASK) {
+    case FUTEX_WAIT:
+    case FUTEX_WAIT_BITSET:
+    case FUTEX_LOCK_PI:
+    case FUTEX_WAIT_REQUEUE_PI:
+      return uaddr;
+    default:
+      return 0;
+  }
+}
+
+/*
+ * Holder of the lock behind a futex address, read while the waiter is
+ * stopped: __owner of a pthread_mutex_t at uaddr, else __cur_writer of a
+ * pthread_rwlock_t waited on at its __writers_futex or __wrphase_futex.
+ * glibc 2.25+ layouts on 64-bit targets:
+ *   mutex  {int __lock; unsigned __count; int __owner; ...}
+ *   rwlock {unsigned __readers, __writers, __wrphase_futex, __writers_futex,
+ *           __pad3, __pad4; int __cur_writer; ...}
+ * A candidate counts only if it names another live thread of pid.
+ */
+static int read_lock_owner(int pid, int tid, ulong uaddr)
+{
+  int words[5] = {};
+  struct iovec local = {.iov_base = words, .iov_len = sizeof(words)};
+  struct iovec remote = {.iov_base = (void *)uaddr, .iov_len = sizeof(words)};
+  if (sizeof(words) != process_vm_readv(pid, &local, 1, &remote, 1, 0)) {
+    return 0;
+  }
+  // the rwlock candidates need the futex word set and both pads zero around
+  // them, other futex users such as condvars would otherwise give false edges
+  int candidates[] = {0 != words[0] ? words[2] : 0,
+                      0 != words[0] && 0 == words[1] && 0 == words[2] ? words[3] : 0,  // at __writers_futex
+                      0 != words[0] && 0 == words[2] && 0 == words[3] ? words[4] : 0}; // at __wrphase_futex
+  char file[128];
+  for (int owner : candidates) {
+    if (owner <= 0 || owner == tid) continue;
+    snprintf(file, sizeof(file), "/proc/%d/task/%d", pid, owner);
+    if (0 == access(file, F_OK)) {
+      return owner;
+    }
+  }
+  return 0;
+}
+
+// utime + stime in clock ticks and the state letter of a thread, -1 if it is gone
+static int64_t read_thread_cpu(int pid, int tid, char *state)
+{
+  char file[128];
+  snprintf(file, sizeof(file), "/proc/%d/task/%d/stat", pid, tid);
+  FILE *fp = fopen(file, "rt");
+  if (!fp) return -1;
+  DEFER(fclose(fp));
+  char buf[1024];
+  if (!fgets(buf, sizeof(buf), fp)) return -1;
+  // the name may contain anything, fields resume after its last ')'
+  char *p = strrchr(buf, ')');
+  ulong utime = 0, stime = 0;
+  if (!p || 3 != sscanf(p + 1, " %c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", state, &utime, &stime)) {
+    return -1;
+  }
+  return utime + stime;
+}
+
+// time spent waiting on a run queue in ns, from schedstat, -1 if unknown
+static int64_t read_thread_run_delay(int pid, int tid)
+{
+  char file[128];
+  snprintf(file, sizeof(file), "/proc/%d/task/%d/schedstat", pid, tid);
+  FILE *fp = fopen(file, "rt");
+  if (!fp) return -1;
+  DEFER(fclose(fp));
+  ulong run_ns = 0, delay_ns = 0;
+  return 2 == fscanf(fp, "%lu %lu", &run_ns, &delay_ns) ? delay_ns : -1;
+}
+
+// state, and cpu ticks and run queue delay within window_ms of every thread
+void sample_tasks(vector<Task*> &tasks, int window_ms)
+{
+  vector<int64_t> cpu(tasks.size(), -1);
+  vector<int64_t> delay(tasks.size(), -1);
+  if (window_ms > 0) {
+    for (int i = 0; i < tasks.size(); i++) {
+      cpu[i] = read_thread_cpu(tasks[i]->pid_, tasks[i]->tid_, &tasks[i]->state_);
+      delay[i] = read_thread_run_delay(tasks[i]->pid_, tasks[i]->tid_);
+    }
+    usleep(window_ms * 1000);
+  }
+  for (int i = 0; i < tasks.size(); i++) {
+    auto t = tasks[i];
+    int64_t cpu_after = read_thread_cpu(t->pid_, t->tid_, &t->state_);
+    int64_t delay_after = read_thread_run_delay(t->pid_, t->tid_);
+    t->cpu_ticks_ = cpu_after >= 0 && cpu[i] >= 0 ? cpu_after - cpu[i] : 0;
+    t->run_delay_ns_ = delay_after >= 0 && delay[i] >= 0 ? delay_after - delay[i] : 0;
+  }
+}
+
+/*
+ * --top: keep the K threads with the most cpu time within the interval,
+ * then the longest run queue delay. Processes stay back to back, hottest
+ * thread first within each.
+ */
+void select_top_tasks(vector<Task*> &tasks)
+{
+  std::unordered_map<int, int> pid_ranks;
+  for (auto t : tasks) {
+    pid_ranks.insert({t->pid_, pid_ranks.size()});
+  }
+  sample_tasks(tasks, CONF.top_interval_ms);
+  std::stable_sort(tasks.begin(), tasks.end(), [](const Task *l, const Task *r) {
+                                                 if (l->cpu_ticks_ != r->cpu_ticks_) return l->cpu_ticks_ > r->cpu_ticks_;
+                                                 return l->run_delay_ns_ > r->run_delay_ns_;
+                                               });
+  for (int i = CONF.top; i < tasks.size(); i++) {
+    if (tasks[i]->stack_) {
+      munmap(tasks[i]->stack_, unwind::RawSnapshot::MAX_STACK_SIZE);
+    }
+    munmap(tasks[i], sizeof(Task));
+  }
+  if (tasks.size() > CONF.top) {
+    tasks.resize(CONF.top);
+  }
+  std::stable_sort(tasks.begin(), tasks.end(), [&](const Task *l, const Task *r) {
+                                                 return pid_ranks[l->pid_] < pid_ranks[r->pid_];
+                                               });
+}
+
+// share of one cpu in percent over the --top interval
+static float cpu_pct(const Task *t)
+{
+  return t->cpu_ticks_ * 100.0 / sysconf(_SC_CLK_TCK) / (CONF.top_interval_ms / 1000.0);
+}
+
+/*
+ * Capture order by --order: threads that burn cpu or are running or blocked
+ * in the kernel come first, the picture of them is the most current and they
+ * are not cut by a budget. Processes stay back to back, unwind caches are
+ * per process.
+ */
+void order_tasks(vector<Task*> &tasks)
+{
+  sample_tasks(tasks, common::ORDER_CPU == CONF.order ? CONF.order_window_ms : 0);
+  auto state_rank = [](const Task *t) { return 'R' == t->state_ ? 0 : 'D' == t->state_ ? 1 : 2; };
+  for (auto begin = tasks.begin(), end = begin; begin != tasks.end(); begin = end) {
+    while (end != tasks.end() && (*end)->pid_ == (*begin)->pid_) end++;
+    std::stable_sort(begin, end, [&](const Task *l, const Task *r) {
+                                   if (l->cpu_ticks_ != r->cpu_ticks_) return l->cpu_ticks_ > r->cpu_ticks_;
+                                   return state_rank(l) < state_rank(r);
+                                 });
+  }
+  LOG(INFO, "capture order, by: %s, first tid: %d, cpu ticks: %ld, state: %c",
+      common::ORDER_CPU == CONF.order ? "cpu" : "state",
+      tasks[0]->tid_, tasks[0]->cpu_ticks_, tasks[0]->state_);
+}
+
+// threads cut by --thread_budget/--total_budget, printed after the stacks
+void report_cuts(const vector<Task*> &tasks, bool print)
+{
+  static const char *CUT_NAMES[] = {"", "truncated", "not_stopped", "skipped"};
+  vector<int> tids[CUT_MAX];
+  for (auto t : tasks) {
+    tids[t->cut_].push_back(t->tid_);
+  }
+  if (tids[CUT_NONE].size() == tasks.size()) return;
+  LOG(WARN, "capture cut by budget, truncated: %ld, not stopped: %ld, skipped: %ld",
+      tids[CUT_TRUNCATED].size(), tids[CUT_NOT_STOPPED].size(), tids[CUT_SKIPPED].size());
+  if (!print) return;
+  if (FORMAT_NDJSON == CONF.format) {
+    OUTPUT.append("{\"budget\":{");
+    for (int cut = CUT_TRUNCATED; cut < CUT_MAX; cut++) {
+      OUTPUT.append("%s\"%s\":[", CUT_TRUNCATED == cut ? "" : ",", CUT_NAMES[cut]);
+      for (int i = 0; i < tids[cut].size(); i++) {
+        OUTPUT.append("%s%d", 0 == i ? "" : ",", tids[cut][i]);
+      }
+      OUTPUT.put(']');
+    }
+    OUTPUT.append("}}\n");
+  } else {
+    o_printf(COLOR_GREEN, "== cut by budget ==\n");
+    for (int cut = CUT_TRUNCATED; cut < CUT_MAX; cut++) {
+      if (tids[cut].empty()) continue;
+      o_printf(COLOR_YELLOW, "%s (%ld):", CUT_NAMES[cut], tids[cut].size());
+      for (auto tid : tids[cut]) {
+        o_printf(COLOR_YELLOW, " %d", tid);
+      }
+      o_printf(COLOR_YELLOW, "\n");
+    }
+  }
+  OUTPUT.flush();
+}
+
+// threads are paused one after another, so the pauses add up to the capture
+void record_capture_stats(const vector<Task*> &tasks)
+{
+  int64_t threads = 0;
+  int64_t pause_us = 0;
+  for (auto t : tasks) {
+    if (!t->was_paused()) continue;
+    threads++;
+    pause_us += t->pause_us_;
+  }
+  STATS.add("capture", "", pause_us * 1000, threads);
+}
+
+/*
+ * Whether a seized and interrupted thread has stopped, EAGAIN if not yet.
+ * A signal that stopped it instead of the interrupt is returned in stop_sig,
+ * to be delivered on detach.
+ */
+static int poll_stopped(int tid, int *stop_sig)
+{
+  int st = 0;
+  int w_pid = wait4(tid, &st, __WALL | WNOHANG, NULL);
+  if (-1 == w_pid) {
+    LOG(WARN, "wait failed, err: %d, errmsg: %s", errno, strerror(errno));
+    return errno;
+  } else if (tid == w_pid && WIFSTOPPED(st)) {
+    bool event_stop = PTRACE_EVENT_STOP == (st >> 16);
+    *stop_sig = event_stop || SIGTRAP == WSTOPSIG(st) ? 0 : WSTOPSIG(st);
+    return 0;
+  } else if (tid == w_pid) {
+    return ESRCH;
+  }
+  return EAGAIN;
+}
+
+// poll_stopped() until deadline
+static int wait_stopped(int tid, int64_t deadline, int *stop_sig)
+{
+  int64_t sleep_us = 10;
+  while (true) {
+    int rc = poll_stopped(tid, stop_sig);
+    if (EAGAIN != rc) {
+      return rc;
+    } else if (current_time() >= deadline) {
+      LOG(WARN, "thread not stopped within budget, tid: %d", tid);
+      return ETIMEDOUT;
+    }
+    usleep(sleep_us);
+    sleep_us = std::min<int64_t>(sleep_us * 2, 1000);
+  }
+}
+
+/*
+ * --perf: nothing is stopped, the threads are sampled while they run. Any
+ * error opening the events, e.g. perf_event_paranoid or seccomp, is left to
+ * the caller, which falls back to ptrace.
+ */
+static int capture_by_perf(const vector<Task*> &tasks)
+{
+  _obstack::ObStack os(CONF.pid);
+  std::unordered_map<int, string> tnames;
+  for (auto t : tasks) {
+    tnames[t->tid_] = t->tname_;
+  }
+  int rc = os.load_perf(tnames);
+  if (0 == rc) {
+    // samples are counted per stack, the ptrace fallback and later rounds of --repeat keep their own setting
+    bool agg = CONF.agg;
+    CONF.agg = true;
+    DEFER(CONF.agg = agg);
+    os.stack_it();
+  }
+  return rc;
+}
+
+/*
+ * --agent: every thread saves its registers and stack in a signal handler
+ * of libobstack_agent.so, nobody is stopped by ptrace; they are unwound
+ * here. pause_us_ is the time spent in the handler, threads started after
+ * iter_task are dropped.
+ */
+static int capture_by_agent(vector<Task*> &tasks)
+{
+  int64_t timeout_us = CONF.total_budget_us > 0 ? CONF.total_budget_us : agent::DEFAULT_TIMEOUT_US;
+  std::unordered_map<int, Task*> tid_tasks;
+  for (auto t : tasks) {
+    tid_tasks[t->tid_] = t;
+  }
+  int captured = 0;
+  for (int i = 0; i < pids.size() && !interrupt; i++) {
+    agent::capture(pids[i], timeout_us, [&](const agent::Thread &thread, const ulong *addrs, int n) {
+                                          auto it = tid_tasks.find(thread.tid_);
+                                          if (it == tid_tasks.end()) return;
+                                          Task *t = it->second;
+                                          t->n_addrs_ = std::min<int64_t>(n, ARRAYSIZE(t->addrs_));
+                                          memcpy(t->addrs_, addrs, t->n_addrs_ * sizeof(t->addrs_[0]));
+                                          t->pause_us_ = thread.cost_ns_ / 1000;
+                                          captured++;
+                                        });
+  }
+  /* still running, a thread blocked in a futex stays there */
+  for (auto t : tasks) {
+    if (CONF.futex && t->is_valid()) {
+      t->futex_ = read_futex_wait(t->pid_, t->tid_);
+    }
+    if (CONF.deadlock && t->futex_) {
+      t->lock_owner_ = read_lock_owner(t->pid_, t->tid_, t->futex_);
+    }
+  }
+  return 0 == captured ? -1 : 0;
+}
+
 bool is_pid_stopped(int pid)
 {
   FILE* status_file;
@@ -259,35 +953,86 @@ bool is_pid_stopped(int pid)
   return stopped;
 }
 
-int main(int argc, char** argv)
+static void free_tasks(vector<Task*> &tasks)
 {
-  int rc = 0;
-  tzset();
-  init_interrupt_signal_set();
-  int64_t s_ts = current_time();
-  if (argc <= 1) {
-    usage_exit();
+  for (auto t : tasks) {
+    if (t->stack_) {
+      munmap(t->stack_, unwind::RawSnapshot::MAX_STACK_SIZE);
+    }
+    munmap(t, sizeof(Task));
   }
-  get_options(argc, argv);
+  tasks.clear();
+}
 
+/*
+ * One round of capturing: list the threads, pause and unwind them in a
+ * child while the parent loads symbols, then symbolize. os lives across
+ * the rounds of --repeat, so that only changed modules are loaded again.
+ */
+static int capture(std::unique_ptr<_obstack::ObStack> &os, int round, int argc, char **argv, int64_t s_ts)
+{
+  int rc = 0;
   vector<Task*> tasks;
-  auto &&task_cb = [&](int tid, char *tname) {
+  auto &&task_cb = [&](int pid, int tid, char *tname) {
                      void *ptr =
                        mmap(0, sizeof(Task), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
                      auto task = new (ptr) Task;
+                     task->pid_ = pid;
                      task->tid_ = tid;
                      strncpy(task->tname_, tname, sizeof(task->tname_));
+                     if (CONF.save_raw) {
+                       void *stack = mmap(0, unwind::RawSnapshot::MAX_STACK_SIZE, PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+                       /* save registers only, the stack cannot be read then */
+                       if (MAP_FAILED == stack) {
+                         LOG(WARN, "mmap stack failed, tid: %d, err: %d, errmsg: %s", tid, errno, strerror(errno));
+                       } else {
+                         task->stack_ = (char *)stack;
+                       }
+                     }
                      tasks.push_back(task);
                    };
-  iter_task(CONF.pid, task_cb, CONF.thread_only);
+  DEFER(free_tasks(tasks));
+  /* processes are captured back to back */
+  for (int pid : pids) {
+    int n_tasks = tasks.size();
+    iter_task(pid, [&](int tid, char *tname) { task_cb(pid, tid, tname); }, CONF.thread_only);
+    if (n_tasks == tasks.size()) {
+      LOG(WARN, "process not exist, pid: %d", pid);
+    }
+  }
   if (0 == tasks.size()) {
-    LOG(WARN, "process not exist, pid: %d", CONF.pid);
     error(common::ENTRY_NOT_EXIST);
   }
+  if (CONF.top > 0) {
+    select_top_tasks(tasks);
+  } else if (common::ORDER_TID != CONF.order) {
+    order_tasks(tasks);
+  }
+  if (CONF.perf_ms > 0) {
+    if (0 == (rc = capture_by_perf(tasks))) {
+      return rc;
+    }
+    LOG(WARN, "perf events unavailable, fall back to ptrace, err: %d, errmsg: %s", rc, strerror(rc));
+  }
   int coreprocess_pid = -1;
   /* disable interrupts while main proc waiting */
   sigprocmask(SIG_BLOCK, &interrupt_sigset, NULL);
   if ((coreprocess_pid = fork()) != 0) {
+    /* load maps and symbols while coreprocess is capturing */
+    bool multi_process = pids.size() > 1;
+    /* several processes share modules by build-id, they start over every round */
+    if (!os || multi_process) {
+      os.reset(new _obstack::ObStack(multi_process ? -1 : CONF.pid));
+      for (int i = 0; multi_process && i < pids.size(); i++) {
+        os->add_process(pids[i]);
+      }
+    } else {
+      os->clear_threads();
+    }
+    if (!CONF.save_raw) {
+      os->update_maps();
+    }
     int status;
     int w_pid = wait(&status);
     sigprocmask(SIG_UNBLOCK, &interrupt_sigset, NULL);
@@ -307,31 +1052,42 @@ int main(int argc, char** argv)
       } else {
         error(common::UNEXPECTED_ERROR, "unhandled status: %d", status);
       }
-      if (0 == rc) {
-        int64_t detach_ts = current_time();
+      log_pause_distribution(tasks);
+      record_capture_stats(tasks);
+      if (0 == rc && CONF.save_raw) {
+        unwind::RawSnapshot snapshot(CONF.pid);
         for (auto t : tasks) {
           if (!t->is_valid()) continue;
-          char *buf = t->bt_;
-          int buf_len = ARRAYSIZE(t->bt_);
-          int pos = 0;
-          for (int i = 0; i < t->n_addrs_; i++) {
-            int n = snprintf(buf + pos, buf_len - pos, "0x%lx%s", t->addrs_[i],
-                             i == t->n_addrs_ - 1 ? "" : " ");
-            if (n < 0 || n >= buf_len) {
-              break;
-            } else {
-              pos += n;
-            }
-          }
-          buf[pos] = '\0';
+          snapshot.add_thread(t->tid_, t->tname_, t->regs_, t->stack_start_, t->stack_, t->stack_len_);
         }
-        _obstack::ObStack os(CONF.pid);
+        rc = snapshot.save(CONF.save_raw);
+        report_cuts(tasks, false);
+      } else if (0 == rc) {
+        int64_t detach_ts = current_time();
         for (auto t : tasks) {
           if (!t->is_valid()) continue;
-          os.add_bt(t->tid_, t->tname_, std::vector<ulong>(t->addrs_, t->addrs_ + t->n_addrs_),
-                    string(t->bt_));
+          std::vector<ulong> addrs(t->addrs_, t->addrs_ + t->n_addrs_);
+          if (multi_process) {
+            os->add_bt(t->pid_, t->tid_, t->tname_, std::move(addrs));
+          } else {
+            os->add_bt(t->tid_, t->tname_, std::move(addrs));
+          }
+          if (CONF.top > 0) {
+            os->set_load(cpu_pct(t), t->run_delay_ns_ / 1e6);
+          }
+          if (CONF.futex) {
+            os->set_futex(t->futex_, t->lock_owner_);
+          }
         }
-        os.stack_it();
+        if (CONF.repeat > 1) {
+          if (FORMAT_NDJSON == CONF.format) {
+            OUTPUT.append("{\"round\":%d}\n", round + 1);
+          } else {
+            o_printf(COLOR_GREEN, "== round %d/%d ==\n", round + 1, CONF.repeat);
+          }
+        }
+        os->stack_it();
+        report_cuts(tasks, true);
         LOG(INFO, "parse addrs finish, cost(ms): %f", (current_time() - detach_ts)/1000.0);
       }
     }
@@ -341,7 +1097,6 @@ int main(int argc, char** argv)
         LOG(WARN, "attention!!! process %d is still stopped", t->tid_);
       }
     }
-    LOG(INFO, "exit, cost(ms): %f", (current_time() - s_ts)/1000.0);
   } else {
     sigprocmask(SIG_UNBLOCK, &interrupt_sigset, NULL);
     install_interrupt_signals();
@@ -352,8 +1107,32 @@ int main(int argc, char** argv)
     }
 
     int task_cnt = 0;
-    do {
-      unw_addr_space_t as = unw_create_addr_space(&_UPT_accessors,0);;
+    bool budget = CONF.thread_budget_us > 0 || CONF.total_budget_us > 0;
+    int64_t total_deadline = CONF.total_budget_us > 0 ? current_time() + CONF.total_budget_us : INT64_MAX;
+    /* seized threads that did not stop within budget, with the time they were given up on;
+       any that stops later is released after the next thread instead of staying stopped */
+    vector<std::pair<Task*, int64_t>> unstopped;
+    auto release_stopped = [&]() {
+      for (auto it = unstopped.begin(); it != unstopped.end();) {
+        int stop_sig = 0;
+        int ret = poll_stopped(it->first->tid_, &stop_sig);
+        if (EAGAIN == ret) {
+          ++it;
+          continue;
+        } else if (0 == ret) {
+          ptrace(PTRACE_DETACH, it->first->tid_, 0, (void *)(long)stop_sig);
+          /* it stopped after it was given up on, the pause is at most this long */
+          it->first->pause_us_ = current_time() - it->second;
+        }
+        it = unstopped.erase(it);
+      }
+    };
+    if (CONF.agent) {
+      rc = capture_by_agent(tasks);
+    } else do {
+      /* unwind tables are read from the local files, not word by word from the stopped thread */
+      unwind::FileMemory file_mem;
+      unw_addr_space_t as = unw_create_addr_space(unwind::upt_accessors(&file_mem), 0);
       if (!as) {
         rc = -1;
         LOG(ERROR, "unw_create_addr_space failed");
@@ -366,10 +1145,33 @@ int main(int argc, char** argv)
         /* ignore error for everyone*/
         DEFER(rc = 0);
         DEFER(task_cnt++);
+        DEFER(release_stopped());
         auto t = tasks[ti];
+        /* cached unwind info is only valid within one process */
+        if (ti > 0 && tasks[ti - 1]->pid_ != t->pid_) {
+          unw_flush_cache(as, 0, 0);
+        }
+        if (!CONF.save_raw && (0 == ti || tasks[ti - 1]->pid_ != t->pid_)) {
+          file_mem.load(t->pid_);
+        }
 
         /* attach */
-        rc = ptrace(PTRACE_ATTACH, t->tid_);
+        int64_t attach_ts = current_time();
+        if (attach_ts >= total_deadline) {
+          t->cut_ = CUT_SKIPPED;
+          continue;
+        }
+        int64_t deadline = CONF.thread_budget_us > 0 ?
+          std::min(total_deadline, attach_ts + CONF.thread_budget_us) : total_deadline;
+        if (budget) {
+          /* no SIGSTOP is queued, a thread that does not stop in time keeps running */
+          rc = ptrace(PTRACE_SEIZE, t->tid_, 0, 0);
+          if (0 == rc) {
+            rc = ptrace(PTRACE_INTERRUPT, t->tid_, 0, 0);
+          }
+        } else {
+          rc = ptrace(PTRACE_ATTACH, t->tid_);
+        }
         if (-1 == rc) {
           if (errno != ESRCH) {
             LOG(WARN, "ptrace attach failed, tid: %d, err: %d, errmsg: %s",
@@ -377,12 +1179,23 @@ int main(int argc, char** argv)
           }
           continue;
         }
-        /* detach use RALL */
-        DEFER(ptrace(PTRACE_DETACH, t->tid_, 0, 0));
+        /* detach use RALL, the pause ends after detach; a thread that never
+           stopped was not paused and is detached by release_stopped() */
+        int stop_sig = 0;
+        DEFER(if (CUT_NOT_STOPPED != t->cut_) t->pause_us_ = current_time() - attach_ts);
+        DEFER(if (CUT_NOT_STOPPED != t->cut_) ptrace(PTRACE_DETACH, t->tid_, 0, (void *)(long)stop_sig));
 
         /* wait stop */
         rc = -1;
-        int wait_loops = 10;
+        if (budget) {
+          rc = wait_stopped(t->tid_, deadline, &stop_sig);
+          if (ETIMEDOUT == rc) {
+            t->cut_ = CUT_NOT_STOPPED;
+            unstopped.push_back({t, current_time()});
+            continue;
+          }
+        }
+        int wait_loops = budget ? 0 : 10;
         while (wait_loops-- > 0) {
           int st = 0;
           int w_pid = wait4(t->tid_, &st, __WALL, NULL);
@@ -401,6 +1214,28 @@ int main(int argc, char** argv)
           continue;
         }
 
+        if (CONF.futex) {
+          t->futex_ = read_futex_wait(t->pid_, t->tid_);
+        }
+        if (CONF.deadlock && t->futex_) {
+          t->lock_owner_ = read_lock_owner(t->pid_, t->tid_, t->futex_);
+        }
+
+        /* copy registers and stack only, unwind later with --load_raw */
+        if (CONF.save_raw) {
+          struct iovec iov = {.iov_base = &t->regs_, .iov_len = sizeof(t->regs_)};
+          if (-1 == ptrace(PTRACE_GETREGSET, t->tid_, NT_PRSTATUS, &iov)) {
+            LOG(WARN, "get regs failed, tid: %d, err: %d, errmsg: %s", t->tid_, errno, strerror(errno));
+            continue;
+          }
+          t->has_regs_ = true;
+          if (t->stack_) {
+            t->stack_len_ = unwind::read_stack(t->tid_, unwind::get_sp(t->regs_), t->stack_,
+                                               unwind::RawSnapshot::MAX_STACK_SIZE, &t->stack_start_);
+          }
+          continue;
+        }
+
         /* unwind backtrace */
         struct UPT_info *ui = (struct UPT_info *)_UPT_create(t->tid_);
         if (!ui) {
@@ -420,8 +1255,16 @@ int main(int argc, char** argv)
             break;
           }
           t->addrs_[t->n_addrs_] = uip;
+          if (budget && current_time() >= deadline) {
+            t->n_addrs_++;
+            t->cut_ = CUT_TRUNCATED;
+            break;
+          }
         } while (++t->n_addrs_ < f_limit && (rc = unw_step(&c)) > 0);
       }
+      /* detached by the kernel when we exit, unless they have stopped by now */
+      release_stopped();
+      LOG(INFO, "unwind memory reads, local: %ld, remote: %ld", file_mem.local_reads(), file_mem.remote_reads());
       if (interrupt) {
         rc = -1;
         LOG(WARN, "interruption occurs, will exit...");
@@ -432,7 +1275,64 @@ int main(int argc, char** argv)
       LOG(INFO, "all tracees detached, task_cnt: %d, cost(ms): %f",
           task_cnt, (current_time() - s_ts)/1000.0);
     }
+    /* the child captures once and leaves */
+    exit(rc);
   }
 
   return rc;
 }
+
+int main(int argc, char** argv)
+{
+  int rc = 0;
+  tzset();
+  init_interrupt_signal_set();
+  int64_t s_ts = current_time();
+  if (argc <= 1) {
+    usage_exit();
+  }
+  if (0 == strcmp(argv[1], "symbolize")) {
+    CONF.symbolize = true;
+    argc--;
+    argv++;
+  }
+  get_options(argc, argv);
+  if (CONF.symbolize) {
+    rc = _obstack::ObStack::symbolize_dumps(argv + optind, argc - optind);
+    STATS.report();
+    return rc;
+  }
+  if (CONF.diff_before) {
+    rc = _obstack::ObStack::diff(CONF.diff_before, CONF.diff_after);
+    STATS.report();
+    return rc;
+  }
+  if (CONF.core) {
+    /* nothing to pause, unwind in place */
+    lib::install_fatal_signals();
+    _obstack::ObStack os(-1);
+    if (0 == (rc = os.load_core(CONF.core, CONF.core_exe))) {
+      int64_t unwound_ts = current_time();
+      os.stack_it();
+      LOG(INFO, "parse addrs finish, cost(ms): %f", (current_time() - unwound_ts)/1000.0);
+    }
+    LOG(INFO, "exit, cost(ms): %f", (current_time() - s_ts)/1000.0);
+    STATS.report();
+    return rc;
+  }
+
+  std::unique_ptr<_obstack::ObStack> os;
+  for (int round = 0; round < CONF.repeat; round++) {
+    if (round > 0) {
+      usleep(CONF.interval_ms * 1000);
+    }
+    // a failed round does not stop the others, the first failure is the exit code
+    int round_rc = capture(os, round, argc, argv, s_ts);
+    if (0 == rc) {
+      rc = round_rc;
+    }
+  }
+  LOG(INFO, "exit, cost(ms): %f", (current_time() - s_ts)/1000.0);
+  STATS.report();
+  return rc;
+}
@@ -21,13 +21,17 @@
 #include <sstream>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include <unistd.h>
 #include <algorithm>
+#include <map>
+#include <iterator>
+#include <tuple>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/wait.h>
 #include <fcntl.h>
-#define HAVE_DECL_BASENAME 1
-#include <libiberty/demangle.h>
-#undef HAVE_DECL_BASENAME
+#include <malloc.h>
 #include "bfd/bfd_utils.h"
 #include "utils/defer.h"
 #include "common/log.h"
@@ -35,8 +39,12 @@
 #include "common/error.h"
 #include "utils/util.h"
 #include "utils/defer.h"
-#include "utils/color_printf.h"
+#include "lib/macro_utils.h"
+#include "common/output.h"
+#include "common/stats.h"
 #include "llvmtool/llvm-dwarfdump.h"
+#include "unwind/core_file.h"
+#include "unwind/perf_sampler.h"
 using namespace std;
 
 using namespace _obstack::common;
@@ -45,15 +53,12 @@ namespace _obstack
 using namespace bfdutils;
 ulong terminator = (ulong)-1;
 
-char *get_demangled_symbol(const char* symbol_name) {
-  uint arg = DMGL_ANSI;
-  arg |= DMGL_PARAMS;
-  arg |= DMGL_TYPES;
-  char* demangled = cplus_demangle(symbol_name, arg);
-  if (!demangled) {
-    demangled = strdup(symbol_name);
-  }
-  return demangled;
+static bool has_line(const LineInfo &line_info)
+{
+  return line_info.filename_.length() > 0 &&
+    0 != line_info.filename_.compare("0") &&
+    0 != line_info.filename_.compare("(null)") &&
+    line_info.line_ > 0;
 }
 
 bool is_same_file(const char *path1, const char *path2) {
@@ -64,11 +69,52 @@ bool is_same_file(const char *path1, const char *path2) {
     && sb1.st_ino == sb2.st_ino;
 }
 
+// frames of dumps and of several processes are placed at MODULE_BASE + module index * MODULE_SPAN + offset
+static const ulong MODULE_BASE = 1UL << 56;
+static const ulong MODULE_SPAN = 1UL << 40;
+
+static const string &module_key(const string &path)
+{
+  auto &build_id = ELF_META.get(path)->build_id_;
+  return build_id.empty() ? path : build_id;
+}
+
+static ulong debug_size(const string &file)
+{
+  return file.empty() ? 0 : ELF_META.get(file)->debug_size_;
+}
+
+// whether the line tables of file can be read within --mem-limit, judged by
+// the uncompressed size of its debug sections on top of the current RSS
+static bool fits_mem_limit(const string &file)
+{
+  int64_t rss = current_rss();
+  int64_t need = debug_size(file);
+  if (rss + need <= CONF.mem_limit) {
+    return true;
+  }
+  LOG(WARN, "memory limit reached, no line numbers, file: %s, rss(MB): %ld, need(MB): %ld, limit(MB): %ld",
+      file.c_str(), rss >> 20, need >> 20, CONF.mem_limit >> 20);
+  return false;
+}
+
 ObStack::ObStack(int pid)
-  : pid_(pid) {}
+  : pid_(pid), prepared_(false), bfd_cache_(new BFDCache()) {}
+
+ObStack::~ObStack()
+{
+  delete bfd_cache_;
+}
+
+const char *ObStack::str(uint32_t id) const
+{
+  return bfd_cache_->strings().str(id);
+}
 
-void ObStack::read_maps(int pid)
+void ObStack::read_maps(int pid, std::vector<Map> &maps)
 {
+  StatsTimer timer("read maps", "", 0);
+  DEFER(timer.set_items(maps.size()));
   char exe[512];
   snprintf(exe, sizeof(exe), "/proc/%d/exe", pid);
 
@@ -79,6 +125,8 @@ void ObStack::read_maps(int pid)
   DEFER(fclose(map_file));
   char line[1024];
   int64_t inode = -1;
+  ulong dev = 0;
+  int64_t first_end = 0;
   char path[256];
   bool has_perm_e;
   int64_t min_addr;
@@ -101,7 +149,7 @@ void ObStack::read_maps(int pid)
       } else if (next_inode != inode) {
         yield = true;
       } else {
-        has_perm_e ?: strlen(next_perms) == 4 && 'x' == next_perms[2];
+        has_perm_e = has_perm_e || (strlen(next_perms) == 4 && 'x' == next_perms[2]);
         if (next_start < min_addr) {
           min_addr = next_start;
         }
@@ -112,12 +160,17 @@ void ObStack::read_maps(int pid)
     }
     if (yield) {
       if (inode > 0 && has_perm_e && path[0] != '[') {
-        maps_.push_back(Map{.path_ = path,
+        maps.push_back(Map{.path_ = path,
               .start_ = (ulong)min_addr,
               .end_ = (ulong)max_addr,
-              .is_exe_ = is_same_file(path, exe)});
+              .is_exe_ = is_same_file(path, exe),
+              .inode_ = (ulong)inode,
+              .dev_ = dev,
+              .first_end_ = (ulong)first_end});
       }
       inode = next_inode;
+      dev = makedev(next_major, next_minor);
+      first_end = next_end;
       memcpy(path, next_path, sizeof(path));
       has_perm_e = strlen(next_perms) == 4 && 'x' == next_perms[2];
       min_addr = next_start;
@@ -136,120 +189,631 @@ void ObStack::load_maps(bfdutils::BFDCache &bfd_cache)
       LOG(WARN, "create pt load failed, file: %s", map.path_.c_str());
     }
   }
+  if (!CONF.no_parse && pid_ > 0) {
+    load_perf_map(bfd_cache);
+  }
   bfd_cache.sort_pt_load();
 }
 
-void ObStack::add_bt(int tid, char *tname, std::vector<ulong> &&addrs, string &&bt)
+/*
+ * JIT compilers describe the code they emit into anonymous memory in
+ * /tmp/perf-<pid>.map, one "START SIZE symbolname" line per function.
+ */
+void ObStack::load_perf_map(bfdutils::BFDCache &bfd_cache)
+{
+  char fn[2][128];
+  snprintf(fn[0], sizeof(fn[0]), "/proc/%d/root/tmp/perf-%d.map", pid_, pid_);
+  snprintf(fn[1], sizeof(fn[1]), "/tmp/perf-%d.map", pid_);
+  FILE *map_file = nullptr;
+  const char *path = nullptr;
+  for (int i = 0; i < 2 && !map_file; i++) {
+    map_file = fopen(path = fn[i], "rt");
+  }
+  if (!map_file) return;
+  DEFER(fclose(map_file));
+
+  struct JitSym
+  {
+    ulong start_;
+    ulong end_;
+    string name_;
+  };
+  std::vector<JitSym> syms;
+  char line[4096];
+  while (fgets(line, sizeof(line), map_file)) {
+    ulong start = 0, size = 0;
+    int pos = 0;
+    if (sscanf(line, "%lx %lx %n", &start, &size, &pos) < 2 || 0 == size) continue;
+    syms.push_back(JitSym{.start_ = start, .end_ = start + size, .name_ = common::trim(line + pos)});
+  }
+  if (syms.empty()) return;
+  // later entries win when the JIT reuses an address range
+  std::stable_sort(syms.begin(), syms.end(), [](const JitSym &l, const JitSym &r) {
+                                               return l.start_ < r.start_;
+                                             });
+  std::vector<SymbolEnt> sym_ents;
+  std::vector<std::pair<ulong, ulong>> regions;
+  // an entry at the address of the previous one replaces it
+  auto add_ent = [&](ulong addr, const string &name) {
+                   if (!sym_ents.empty() && sym_ents.back().addr_ == addr) {
+                     sym_ents.pop_back();
+                   }
+                   sym_ents.push_back({.addr_ = addr, .name_ = name, .demangled_ = nullptr});
+                 };
+  // functions enclosing the current one, ends decreasing towards the back
+  std::vector<const JitSym*> outers;
+  // the enclosing function resumes after each inner one ends, "???" in gaps between functions
+  auto close_until = [&](ulong addr) {
+                       while (!outers.empty() && outers.back()->end_ <= addr) {
+                         ulong end = outers.back()->end_;
+                         outers.pop_back();
+                         add_ent(end, outers.empty() ? "???" : outers.back()->name_);
+                       }
+                     };
+  for (int i = 0; i < syms.size(); i++) {
+    auto &sym = syms[i];
+    if (i + 1 < syms.size() && syms[i + 1].start_ == sym.start_) continue;
+    bool overlap_file = std::any_of(maps_.begin(), maps_.end(), [&](const Map &map) {
+                                                                  return sym.start_ < map.end_ && map.start_ < sym.end_;
+                                                                });
+    if (overlap_file) continue;
+    close_until(sym.start_);
+    add_ent(sym.start_, sym.name_);
+    // overlapped up to their end by sym, nothing of them to resume
+    while (!outers.empty() && outers.back()->end_ <= sym.end_) {
+      outers.pop_back();
+    }
+    outers.push_back(&sym);
+    if (!regions.empty() && sym.start_ <= regions.back().second) {
+      regions.back().second = std::max(regions.back().second, sym.end_);
+    } else {
+      regions.push_back(std::make_pair(sym.start_, sym.end_));
+    }
+  }
+  close_until(ULONG_MAX);
+  auto *st = bfd_cache.create_synthetic_st(path, std::move(sym_ents));
+  for (auto &&region : regions) {
+    bfd_cache.create_synthetic_pt_load(st, region.first, region.second);
+  }
+  LOG(INFO, "load perf map, file: %s, symbols: %d, regions: %d", path, syms.size(), regions.size());
+}
+
+void ObStack::prefetch_debug_files()
 {
-  bts_.push_back({.tid_ = tid, .tname_ = string(tname), .addrs_ = addrs, .bt_ = bt});
+  std::unordered_set<string> files;
+  for (auto &&map : maps_) {
+    auto *pt_load = bfd_cache_->find_pt_load(map.start_);
+    if (!pt_load || !pt_load->st_) continue;
+    auto &file = pt_load->st_->bfd_info_->debug_file_;
+    if (!file.empty() && files.insert(file).second) {
+      common::prefetch_file(file.c_str());
+    }
+  }
+  LOG(DEBUG, "prefetch debug files, count: %d", files.size());
+}
+
+void ObStack::prepare()
+{
+  if (prepared_) return;
+  prepared_ = true;
+  int64_t s_ts = current_time();
+  StatsTimer timer("prepare");
+  if (proc_maps_.empty()) {
+    read_maps(pid_, maps_);
+    load_maps(*bfd_cache_);
+  } else {
+    load_modules(modules_);
+  }
+  // readahead is charged to the memory cgroup as page cache, skip it under --mem-limit
+  if (!CONF.no_parse && !CONF.no_lineno && 0 == CONF.mem_limit) {
+    prefetch_debug_files();
+  }
+  LOG(INFO, "prepare symbols finish, cost(ms): %f", (current_time() - s_ts)/1000.0);
+}
+
+// meta was parsed from another file than the mapped one: another inode, or the same inode rewritten
+bool ObStack::is_replaced(const bfdutils::ElfMeta &meta, const Map &map) const
+{
+  if (meta.inode_ != map.inode_ || meta.dev_ != map.dev_) {
+    return true;
+  }
+  char file[128];
+  snprintf(file, sizeof(file), "/proc/%d/map_files/%lx-%lx", pid_, map.start_, map.first_end_);
+  struct stat sb;
+  // not readable without ptrace access, the inode has to do then
+  return 0 == stat(file, &sb) && meta.mtime_ns_ != sb.st_mtim.tv_sec * 1000000000L + sb.st_mtim.tv_nsec;
+}
+
+/*
+ * --repeat keeps the modules of the previous capture. A mapping is
+ * unchanged if its range, path, inode and mtime all match; only the others
+ * are unloaded or loaded. A path now backed by a different file loses its
+ * cached symbols and ElfMeta so that it is parsed again. The JIT perf map
+ * is read by the first capture only.
+ */
+void ObStack::update_maps()
+{
+  if (!prepared_ || !proc_maps_.empty()) {
+    prepare();
+    return;
+  }
+  StatsTimer timer("update maps");
+  std::vector<Map> maps;
+  read_maps(pid_, maps);
+  auto less = [](const Map &l, const Map &r) {
+                return std::tie(l.start_, l.end_, l.inode_, l.dev_, l.path_) <
+                  std::tie(r.start_, r.end_, r.inode_, r.dev_, r.path_);
+              };
+  std::vector<Map> removed, added;
+  std::set_difference(maps_.begin(), maps_.end(), maps.begin(), maps.end(), std::back_inserter(removed), less);
+  std::set_difference(maps.begin(), maps.end(), maps_.begin(), maps_.end(), std::back_inserter(added), less);
+  if (removed.empty() && added.empty()) {
+    return;
+  }
+  for (auto &&map : removed) {
+    bfd_cache_->remove_pt_loads(map.start_, map.end_);
+    for (auto it = loc_cache_.begin(); it != loc_cache_.end();) {
+      it = it->first >= map.start_ && it->first < map.end_ ? loc_cache_.erase(it) : std::next(it);
+    }
+  }
+  for (auto &&map : added) {
+    auto *meta = ELF_META.get(map.path_);
+    if (meta->image_ && is_replaced(*meta, map)) {
+      LOG(INFO, "file replaced, reload, file: %s", map.path_.c_str());
+      bfd_cache_->forget_symbols(map.path_);
+    }
+    if (!bfd_cache_->create_new_pt_load(map.path_, (void*)map.start_, (void*)map.end_, map.is_exe_, !CONF.no_parse)) {
+      LOG(WARN, "create pt load failed, file: %s", map.path_.c_str());
+    }
+  }
+  bfd_cache_->sort_pt_load();
+  maps_ = std::move(maps);
+  timer.set_items(removed.size() + added.size());
+  LOG(INFO, "update maps, removed: %ld, added: %ld", removed.size(), added.size());
+}
+
+void ObStack::add_bt(int tid, char *tname, std::vector<ulong> &&addrs)
+{
+  bts_.push_back({.pid_ = pid_, .tid_ = tid, .tname_ = string(tname), .addrs_ = std::move(addrs)});
+}
+
+void ObStack::add_process(int pid)
+{
+  auto &maps = proc_maps_[pid];
+  read_maps(pid, maps);
+  for (auto &&map : maps) {
+    auto &module = modules_.maps_[modules_.get(module_key(map.path_))];
+    module.path_ = map.path_;
+    module.is_exe_ = module.is_exe_ || map.is_exe_;
+  }
+}
+
+void ObStack::add_bt(int pid, int tid, char *tname, std::vector<ulong> &&addrs)
+{
+  auto &maps = proc_maps_[pid];
+  std::vector<ulong> abs_addrs(addrs);
+  for (auto &&addr : addrs) {
+    auto it = std::upper_bound(maps.begin(), maps.end(), addr, [](ulong addr, const Map &m) { return addr < m.end_; });
+    if (it == maps.end() || addr < it->start_) continue;
+    ulong load_vaddr = ELF_META.get(it->path_)->load_vaddr_;
+    addr = MODULE_BASE + modules_.get(module_key(it->path_)) * MODULE_SPAN + addr - (it->start_ - load_vaddr);
+  }
+  bts_.push_back({.pid_ = pid, .tid_ = tid, .tname_ = string(tname), .addrs_ = std::move(addrs),
+                  .abs_addrs_ = std::move(abs_addrs)});
+}
+
+void ObStack::set_load(float cpu_pct, float run_delay_ms)
+{
+  auto &bt = bts_.back();
+  bt.has_load_ = true;
+  bt.cpu_pct_ = cpu_pct;
+  bt.run_delay_ms_ = run_delay_ms;
+}
+
+void ObStack::set_futex(ulong futex, int lock_owner)
+{
+  auto &bt = bts_.back();
+  bt.futex_ = futex;
+  bt.lock_owner_ = lock_owner;
 }
 
 template<typename Addrs>
-void ObStack::print_stack_frames(Addrs &addrs, bool with_frame_no)
+void ObStack::print_stack_frames(Addrs &addrs, bool with_frame_no, const std::vector<ulong> *abs_addrs)
 {
 #define PREFIX "0x%016lx in"
   int frame = 0;
-  for (auto &&addr : addrs) {
+  for (auto &&key : addrs) {
     auto it = loc_cache_.end();
+    ulong addr = abs_addrs ? (*abs_addrs)[frame] : key;
     if (with_frame_no) {
-      c_printf(COLOR_YELLOW, "#%-4d ", frame++);
-    }
-    if ((it = loc_cache_.find(addr)) != loc_cache_.end()) {
-      auto &loc = *it->second;
-      bool fn_valid =
-        loc.filename_.length() > 0 &&
-        0 != loc.filename_.compare("0") &&
-        0 != loc.filename_.compare("(null)") &&
-        loc.line_ > 0;
-      if (fn_valid) {
-        c_printf(COLOR_CYAN, PREFIX " %s at %s:%d\n", addr, loc.function_.c_str(),
-               loc.filename_.c_str(), loc.line_);
+      o_printf(COLOR_YELLOW, "#%-4d ", frame);
+    }
+    frame++;
+    if ((it = loc_cache_.find(key)) != loc_cache_.end()) {
+      auto &loc = it->second;
+      if (loc.line_ > 0) {
+        o_printf(COLOR_CYAN, PREFIX " %s at %s:%d\n", addr, str(loc.function_),
+               str(loc.filename_), loc.line_);
       } else {
-        c_printf(COLOR_CYAN, PREFIX " %s from %s\n", addr, loc.function_.c_str(),
-               loc.file_.c_str());
+        o_printf(COLOR_CYAN, PREFIX " %s from %s\n", addr, str(loc.function_),
+               str(loc.file_));
       }
     } else {
-      c_printf(COLOR_CYAN, PREFIX " ???\n", addr);
+      o_printf(COLOR_CYAN, PREFIX " ???\n", addr);
     }
   }
 #undef PREFIX
 }
 
-void ObStack::gen_result()
+const ObStack::Map *ObStack::find_map(ulong addr) const
 {
-  if (CONF.agg) {
-    struct Value {
-      vector<int> tids_;
-      vector<string> tnames_;
-      vector<ulong> *addrs_;
-    };
-    std::unordered_map<string, Value*> bt_map;
-    for (auto &&bt : bts_) {
-      auto it = bt_map.find(bt.bt_);
-      if (it == bt_map.end()) {
-        auto *val = new Value();
-        val->addrs_ = &bt.addrs_;
-        it = bt_map.insert({bt.bt_, val}).first;
+  auto it = std::upper_bound(maps_.begin(), maps_.end(), addr, [](ulong addr, const Map &map) {
+                                                                 return addr < map.end_;
+                                                               });
+  return it != maps_.end() && it->start_ <= addr ? &*it : nullptr;
+}
+
+void ObStack::print_frames_json(const std::vector<ulong> &addrs, const std::vector<ulong> *abs_addrs)
+{
+  OUTPUT.append("\"frames\":[");
+  for (int i = 0; i < addrs.size(); i++) {
+    auto addr = addrs[i];
+    OUTPUT.append("%s{\"addr\":\"0x%lx\"", 0 == i ? "" : ",", abs_addrs ? (*abs_addrs)[i] : addr);
+    auto *map = find_map(addr);
+    auto it = loc_cache_.find(addr);
+    auto *loc = it != loc_cache_.end() ? &it->second : nullptr;
+    if (map || loc) {
+      OUTPUT.append(",\"module\":");
+      OUTPUT.json_string(map ? map->path_.c_str() : str(loc->file_));
+    }
+    // module, build_id and offset locate the frame off the host, as a --no_parse text dump does
+    auto *build_id = map ? &ELF_META.get(map->path_)->build_id_ : nullptr;
+    if (build_id && !build_id->empty()) {
+      OUTPUT.append(",\"build_id\":\"%s\"", build_id->c_str());
+    }
+    auto *pt_load = bfd_cache_->find_pt_load(addr);
+    if (pt_load) {
+      OUTPUT.append(",\"offset\":\"0x%lx\"", BFDCache::addr2offset(pt_load, addr));
+    } else if (map) {
+      OUTPUT.append(",\"offset\":\"0x%lx\"", addr - map->start_);
+    }
+    if (loc) {
+      OUTPUT.append(",\"function\":");
+      OUTPUT.json_string(str(loc->function_));
+      if (loc->line_ > 0) {
+        OUTPUT.append(",\"file\":");
+        OUTPUT.json_string(str(loc->filename_));
+        OUTPUT.append(",\"line\":%u", loc->line_);
       }
-      it->second->tids_.push_back(bt.tid_);
-      it->second->tnames_.push_back(bt.tname_);
-    }
-    using Iterator = decltype(bt_map)::iterator;
-    std::vector<Iterator> sorted_bts;
-    for (auto it = bt_map.begin(); it != bt_map.end(); it++) {
-      sorted_bts.push_back(it);
-    }
-    std::sort(sorted_bts.begin(), sorted_bts.end(), [](Iterator &l, Iterator &r) {
-                                                      return l->second->tids_.size() > r->second->tids_.size();
-                                                    });
-    for (auto &&it : sorted_bts) {
-      c_printf(COLOR_YELLOW, "Threads (");
-      auto &tids = it->second->tids_;
-      auto &tnames = it->second->tnames_;
-      for (int i = 0; i < tids.size(); i++) {
-        c_printf(COLOR_YELLOW, "%s%d-%s", 0 == i ? "" : ", ", tids[i], tnames[i].c_str());
+    }
+    OUTPUT.put('}');
+  }
+  OUTPUT.put(']');
+}
+
+// module table of a --no_parse dump, lets --diff symbolize it later
+void ObStack::print_maps()
+{
+  for (auto &&map : maps_) {
+    auto &build_id = ELF_META.get(map.path_)->build_id_;
+    o_printf(COLOR_CYAN, "map: 0x%lx-0x%lx %d %s %s\n", map.start_, map.end_, map.is_exe_,
+             build_id.empty() ? "-" : build_id.c_str(), map.path_.c_str());
+  }
+}
+
+void ObStack::print_thread(const Bt &bt)
+{
+  if (FORMAT_NDJSON == CONF.format) {
+    OUTPUT.append("{\"tid\":%d,\"name\":", bt.tid_);
+    OUTPUT.json_string(bt.tname_.c_str());
+    if (bt.has_load_) {
+      OUTPUT.append(",\"cpu\":%.1f,\"run_delay_ms\":%.1f", bt.cpu_pct_, bt.run_delay_ms_);
+    }
+    OUTPUT.put(',');
+    print_frames_json(bt.addrs_, abs_addrs(bt));
+    OUTPUT.append("}\n");
+  } else if (CONF.no_parse) {
+    o_printf(COLOR_CYAN, "tid: %d, tname: %s, bt:", bt.tid_, bt.tname_.c_str());
+    // module+offset stays meaningful outside of the process, see read_dump()
+    for (auto addr : bt.addrs_) {
+      auto *map = find_map(addr);
+      PTLoad *pt_load = map ? bfd_cache_->find_pt_load(addr) : nullptr;
+      if (pt_load) {
+        o_printf(COLOR_CYAN, " %s+0x%lx", module_key(map->path_).c_str(), BFDCache::addr2offset(pt_load, addr));
+      } else {
+        o_printf(COLOR_CYAN, " 0x%lx", addr);
       }
-      c_printf(COLOR_YELLOW, ")\n");
-      print_stack_frames(*it->second->addrs_);
     }
+    o_printf(COLOR_CYAN, "\n");
   } else {
-    for (auto &&bt : bts_) {
-      c_printf(COLOR_YELLOW, "Thread %d (%s)\n", bt.tid_, bt.tname_.c_str());
-      print_stack_frames(bt.addrs_);
+    if (bt.has_load_) {
+      o_printf(COLOR_YELLOW, "Thread %d (%s) cpu: %.1f%%, run delay: %.1fms\n", bt.tid_, bt.tname_.c_str(),
+               bt.cpu_pct_, bt.run_delay_ms_);
+    } else {
+      o_printf(COLOR_YELLOW, "Thread %d (%s)\n", bt.tid_, bt.tname_.c_str());
     }
+    print_stack_frames(bt.addrs_, true, abs_addrs(bt));
   }
+  OUTPUT.end_record();
 }
 
-int ObStack::stack_it()
+/*
+ * Group threads by a key computed from the raw frames: the return addresses
+ * themselves, or ids of the functions they resolve to. Groups come out
+ * sorted by thread count, or by cpu usage with --top, ties in order of first
+ * appearance.
+ */
+void ObStack::aggregate(std::vector<Group> &groups)
 {
-  bfdutils::BFDCache bfd_cache;
-  read_maps(pid_);
-  load_maps(bfd_cache);
-  if (CONF.no_parse) {
+  StatsTimer timer("aggregate", "", bts_.size());
+  const ulong UNRESOLVED = 1UL << 63;
+  std::unordered_map<std::vector<ulong>, int, common::U64VecHash> key_map;
+  std::vector<ulong> key;
+  for (int i = 0; i < bts_.size(); i++) {
+    auto &addrs = bts_[i].addrs_;
+    int n_frames = CONF.agg_top > 0 ? std::min<int>(CONF.agg_top, addrs.size()) : addrs.size();
+    key.assign(addrs.begin(), addrs.begin() + n_frames);
+    if (AGG_BY_FUNC == CONF.agg_by) {
+      for (auto &&k : key) {
+        auto it = loc_cache_.find(k);
+        if (it == loc_cache_.end() || lib::StringPool::UNKNOWN == it->second.function_) {
+          // "???" frames of different code must not group together, keep the address,
+          // module-relative with several processes
+          k |= UNRESOLVED;
+        } else {
+          // interned, equal names share one id
+          k = it->second.function_;
+        }
+      }
+    }
+    auto it = key_map.find(key);
+    if (it == key_map.end()) {
+      it = key_map.insert({key, groups.size()}).first;
+      groups.push_back(Group{.bt_idxs_ = {}, .cpu_pct_ = 0, .run_delay_ms_ = 0});
+    }
+    auto &group = groups[it->second];
+    group.bt_idxs_.push_back(i);
+    group.cpu_pct_ += bts_[i].cpu_pct_;
+    group.run_delay_ms_ += bts_[i].run_delay_ms_;
+  }
+  std::stable_sort(groups.begin(), groups.end(), [](const Group &l, const Group &r) {
+                                                   if (CONF.top > 0) return l.cpu_pct_ > r.cpu_pct_;
+                                                   return l.bt_idxs_.size() > r.bt_idxs_.size();
+                                                 });
+  LOG(DEBUG, "aggregate finish, threads: %ld, groups: %ld", bts_.size(), groups.size());
+}
+
+void ObStack::print_group(const Group &group)
+{
+  auto &addrs = bts_[group.bt_idxs_[0]].addrs_;
+  std::vector<ulong> frames(addrs.begin(),
+                            CONF.agg_top > 0 && CONF.agg_top < addrs.size() ? addrs.begin() + CONF.agg_top : addrs.end());
+  if (FORMAT_NDJSON == CONF.format) {
+    OUTPUT.append("{\"count\":%ld,", group.bt_idxs_.size());
+    if (CONF.top > 0) {
+      OUTPUT.append("\"cpu\":%.1f,\"run_delay_ms\":%.1f,", group.cpu_pct_, group.run_delay_ms_);
+    }
+    OUTPUT.append("\"threads\":[");
+    for (int i = 0; i < group.bt_idxs_.size(); i++) {
+      auto &bt = bts_[group.bt_idxs_[i]];
+      OUTPUT.append("%s{\"tid\":%d,\"name\":", 0 == i ? "" : ",", bt.tid_);
+      OUTPUT.json_string(bt.tname_.c_str());
+      OUTPUT.put('}');
+    }
+    OUTPUT.append("],");
+    print_frames_json(frames, abs_addrs(bts_[group.bt_idxs_[0]]));
+    OUTPUT.append("}\n");
+  } else {
+    o_printf(COLOR_YELLOW, "Threads (");
+    for (int i = 0; i < group.bt_idxs_.size(); i++) {
+      auto &bt = bts_[group.bt_idxs_[i]];
+      o_printf(COLOR_YELLOW, "%s%d-%s", 0 == i ? "" : ", ", bt.tid_, bt.tname_.c_str());
+    }
+    if (CONF.top > 0) {
+      o_printf(COLOR_YELLOW, ") cpu: %.1f%%, run delay: %.1fms\n", group.cpu_pct_, group.run_delay_ms_);
+    } else {
+      o_printf(COLOR_YELLOW, ")\n");
+    }
+    print_stack_frames(frames, true, abs_addrs(bts_[group.bt_idxs_[0]]));
+  }
+  OUTPUT.end_record();
+}
+
+void ObStack::gen_result()
+{
+  std::vector<Group> groups;
+  if (CONF.agg) {
+    aggregate(groups);
+  }
+  StatsTimer timer("output", "", bts_.size());
+  if (CONF.agg) {
+    for (auto &&group : groups) {
+      print_group(group);
+    }
+  } else {
     for (auto &&bt : bts_) {
-      c_printf(COLOR_CYAN, "tid: %d, tname: %s, bt:", bt.tid_, bt.tname_.c_str());
-      for (auto addr : bt.addrs_) {
-        ulong v = addr;
-        PTLoad *pt_load = bfd_cache.find_pt_load(addr);
-        if (pt_load && pt_load->is_exe_) {
-          v = BFDCache::addr2offset(pt_load, addr);
+      print_thread(bt);
+    }
+  }
+  OUTPUT.flush();
+}
+
+// data symbol of addr in the data or bss segment of a module of pid, empty if none
+string ObStack::data_symbol(int pid, ulong addr)
+{
+  auto &maps = proc_maps_.empty() ? maps_ : proc_maps_[pid];
+  for (auto &&map : maps) {
+    auto *meta = ELF_META.get(map.path_);
+    ulong offset = addr - (map.start_ - meta->load_vaddr_);
+    bool in_module = std::any_of(meta->segments_.begin(), meta->segments_.end(), [&](const ElfSegment &seg) {
+                                                                                   return offset >= seg.vaddr_ &&
+                                                                                     offset < seg.vaddr_ + seg.memsz_;
+                                                                                 });
+    if (!in_module) continue;
+    ulong module_start = proc_maps_.empty() ? map.start_ :
+      MODULE_BASE + modules_.get(module_key(map.path_)) * MODULE_SPAN + meta->load_vaddr_;
+    auto *pt_load = bfd_cache_->find_pt_load(module_start);
+    return pt_load ? BFDCache::data_symbol(pt_load->st_, offset) : "";
+  }
+  return "";
+}
+
+/*
+ * With --deadlock, every lock whose holder is known comes first, most
+ * waiters first, with the holder's stack when it was captured, then every
+ * cycle of the wait-for graph. A thread waits on one futex at a time, so
+ * each thread has at most one outgoing edge and cycles are found by
+ * walking from every waiter.
+ */
+void ObStack::print_locks()
+{
+  std::unordered_map<int, int> idx_of_tid;
+  for (int i = 0; i < bts_.size(); i++) {
+    idx_of_tid[bts_[i].tid_] = i;
+  }
+  std::map<std::pair<int, ulong>, int> lock_idxs;
+  std::vector<std::vector<int>> waiters;
+  for (int i = 0; i < bts_.size(); i++) {
+    if (0 == bts_[i].lock_owner_) continue;
+    auto it = lock_idxs.insert({std::make_pair(bts_[i].pid_, bts_[i].futex_), waiters.size()}).first;
+    if (it->second == waiters.size()) {
+      waiters.push_back(std::vector<int>());
+    }
+    waiters[it->second].push_back(i);
+  }
+  std::stable_sort(waiters.begin(), waiters.end(), [](const std::vector<int> &l, const std::vector<int> &r) {
+                                                     return l.size() > r.size();
+                                                   });
+  for (auto &&idxs : waiters) {
+    auto &waiter = bts_[idxs[0]];
+    string symbol = data_symbol(waiter.pid_, waiter.futex_);
+    auto holder = idx_of_tid.find(waiter.lock_owner_);
+    if (FORMAT_NDJSON == CONF.format) {
+      OUTPUT.append("{\"lock\":\"0x%lx\",\"symbol\":", waiter.futex_);
+      OUTPUT.json_string(symbol.c_str());
+      OUTPUT.append(",\"owner\":%d,\"waiters\":[", waiter.lock_owner_);
+      for (int i = 0; i < idxs.size(); i++) {
+        OUTPUT.append("%s%d", 0 == i ? "" : ",", bts_[idxs[i]].tid_);
+      }
+      OUTPUT.put(']');
+      // the holder's stack, absent if it was not captured
+      if (holder != idx_of_tid.end()) {
+        auto &bt = bts_[holder->second];
+        OUTPUT.put(',');
+        print_frames_json(bt.addrs_, abs_addrs(bt));
+      }
+      OUTPUT.append("}\n");
+      continue;
+    }
+    o_printf(COLOR_GREEN, "== lock 0x%lx%s%s%s held by %d, %ld waiters ==\n", waiter.futex_,
+             symbol.empty() ? "" : " (&", symbol.c_str(), symbol.empty() ? "" : ")", waiter.lock_owner_, idxs.size());
+    for (int i = 0; i < idxs.size(); i++) {
+      o_printf(COLOR_YELLOW, "%s%d-%s", 0 == i ? "waiters: " : ", ", bts_[idxs[i]].tid_, bts_[idxs[i]].tname_.c_str());
+    }
+    o_printf(COLOR_YELLOW, "\n");
+    if (holder == idx_of_tid.end()) {
+      o_printf(COLOR_YELLOW, "holder %d not captured\n", waiter.lock_owner_);
+    } else {
+      print_thread(bts_[holder->second]);
+    }
+  }
+  // 0: not visited, 1: on the current walk, 2: done
+  std::vector<char> state(bts_.size(), 0);
+  for (int i = 0; i < bts_.size(); i++) {
+    std::vector<int> walk;
+    int cur = i;
+    while (cur >= 0 && 0 == state[cur]) {
+      state[cur] = 1;
+      walk.push_back(cur);
+      auto it = 0 == bts_[cur].lock_owner_ ? idx_of_tid.end() : idx_of_tid.find(bts_[cur].lock_owner_);
+      cur = it == idx_of_tid.end() ? -1 : it->second;
+    }
+    if (cur >= 0 && 1 == state[cur]) {
+      std::vector<int> cycle(std::find(walk.begin(), walk.end(), cur), walk.end());
+      if (FORMAT_NDJSON == CONF.format) {
+        OUTPUT.append("{\"deadlock\":[");
+        for (int j = 0; j < cycle.size(); j++) {
+          OUTPUT.append("%s%d", 0 == j ? "" : ",", bts_[cycle[j]].tid_);
+        }
+        OUTPUT.append("]}\n");
+      } else {
+        o_printf(COLOR_RED, "== deadlock: %ld threads ==\n", cycle.size());
+        for (int idx : cycle) {
+          auto &bt = bts_[idx];
+          string symbol = data_symbol(bt.pid_, bt.futex_);
+          o_printf(COLOR_RED, "Thread %d (%s) waits on 0x%lx%s%s%s held by %d\n", bt.tid_, bt.tname_.c_str(), bt.futex_,
+                   symbol.empty() ? "" : " (&", symbol.c_str(), symbol.empty() ? "" : ")", bt.lock_owner_);
+        }
+        for (int idx : cycle) {
+          print_thread(bts_[idx]);
         }
-        c_printf(COLOR_CYAN, " 0x%lx", v);
       }
-      c_printf(COLOR_CYAN, "\n");
     }
-    return 0;
+    for (int idx : walk) {
+      state[idx] = 2;
+    }
   }
-  std::unordered_map<ulong, LineInfo*> addr_map;
-  std::for_each(bts_.begin(), bts_.end(), [&](decltype(bts_[0]) &bt) {
-                                            for (auto &&addr : bt.addrs_) {
-                                              addr_map.insert({addr, new LineInfo()});
-                                            }
-                                          });
-  LOG(DEBUG, "aggregated addrs count: %d", addr_map.size());
+}
+
+/*
+ * With --futex, one section per futex address, most waiters first, then the
+ * threads that wait on none. Private futexes are per process, so the pid is
+ * part of the key.
+ */
+void ObStack::print_result()
+{
+  if (!CONF.futex) {
+    gen_result();
+    return;
+  }
+  std::map<std::pair<int, ulong>, int> idxs;
+  std::vector<std::vector<Bt>> groups;
+  for (auto &&bt : bts_) {
+    auto key = std::make_pair(0 == bt.futex_ ? 0 : bt.pid_, bt.futex_);
+    auto it = idxs.insert({key, groups.size()}).first;
+    if (it->second == groups.size()) {
+      groups.push_back(std::vector<Bt>());
+    }
+    groups[it->second].push_back(std::move(bt));
+  }
+  std::stable_sort(groups.begin(), groups.end(), [](const std::vector<Bt> &l, const std::vector<Bt> &r) {
+                                                   bool l_wait = 0 != l[0].futex_, r_wait = 0 != r[0].futex_;
+                                                   return l_wait != r_wait ? l_wait : l.size() > r.size();
+                                                 });
+  for (auto &&group : groups) {
+    ulong futex = group[0].futex_;
+    string symbol = 0 == futex ? "" : data_symbol(group[0].pid_, futex);
+    if (FORMAT_NDJSON == CONF.format) {
+      if (0 == futex) {
+        OUTPUT.append("{\"futex\":null,\"threads\":%ld}\n", group.size());
+      } else {
+        OUTPUT.append("{\"futex\":\"0x%lx\",\"symbol\":", futex);
+        OUTPUT.json_string(symbol.c_str());
+        OUTPUT.append(",\"threads\":%ld}\n", group.size());
+      }
+    } else if (0 == futex) {
+      o_printf(COLOR_GREEN, "== %ld threads not waiting on a futex ==\n", group.size());
+    } else {
+      o_printf(COLOR_GREEN, "== %ld threads waiting on futex 0x%lx%s%s%s ==\n", group.size(), futex,
+               symbol.empty() ? "" : " (&", symbol.c_str(), symbol.empty() ? "" : ")");
+    }
+    bts_ = std::move(group);
+    gen_result();
+  }
+}
+
+void ObStack::symbolize(const std::vector<ulong> &abs_addrs)
+{
+  auto &bfd_cache = *bfd_cache_;
+  StatsTimer timer("symbolize", "", abs_addrs.size());
+  int64_t cached = 0;
+  DEFER(timer.set_hits(cached));
   std::unordered_map<std::string, std::vector<std::pair<ulong/*abs_address*/, ulong/*relative_address*/>> > file_addrs_map;
-  for (auto && kv: addr_map) {
-    auto addr = kv.first;
+  for (auto addr : abs_addrs) {
+    if (loc_cache_.find(addr) != loc_cache_.end()) {
+      cached++;
+      continue;
+    }
     auto *pt_load = bfd_cache.find_pt_load(addr);
     if (!pt_load) {
       LOG(WARN, "no pt load founded, addr: %p", addr);
@@ -263,33 +827,450 @@ int ObStack::stack_it()
       it->second.push_back(std::make_pair(addr, offset));
     }
   }
+  std::vector<decltype(file_addrs_map)::value_type*> files;
   for (auto &&kv : file_addrs_map) {
-    auto &file = kv.first;
-    auto &addr_pairs = kv.second;
+    files.push_back(&kv);
+  }
+  if (CONF.mem_limit > 0) {
+    // smallest debuginfo first, most files get line numbers before the budget runs out
+    std::sort(files.begin(), files.end(), [](decltype(files[0]) l, decltype(files[0]) r) {
+                                            return debug_size(l->first) < debug_size(r->first);
+                                          });
+  }
+  for (auto *kv : files) {
+    auto &file = kv->first;
+    auto &addr_pairs = kv->second;
     std::vector<ulong> addrs(addr_pairs.size());
     std::transform(addr_pairs.begin(), addr_pairs.end(), addrs.begin(), [](decltype(addr_pairs[0]) &addr_pair) { return addr_pair.second;});
-    if (!common::file_exist(string(file))) {
-      LOG(ERROR, "file not exist: %s", file.c_str());
-      common::error(common::FILE_NOT_EXIST);
-    }
-    LLVMDwarfDump llvmdwdump(file.c_str());
     std::vector<LineInfo> line_infos(addrs.size());
     std::fill(line_infos.begin(), line_infos.end(), LineInfo());
-    if (!CONF.no_lineno) {
+    // synthetic symbol tables (JIT code) have no debuginfo
+    if (!CONF.no_lineno && !file.empty() && (0 == CONF.mem_limit || fits_mem_limit(file))) {
+      if (!common::file_exist(string(file))) {
+        LOG(ERROR, "file not exist: %s", file.c_str());
+        common::error(common::FILE_NOT_EXIST);
+      }
+      LLVMDwarfDump llvmdwdump(file.c_str());
       llvmdwdump.addr2line(addrs, line_infos);
     }
+    if (CONF.mem_limit > 0) {
+      // the DWARFContext and file buffer are gone, hand their memory back
+      malloc_trim(0);
+    }
+    StatsTimer lookup_timer("symbol lookup", file.c_str(), addrs.size());
+    int hits = bfd_cache.hit_count();
+    DEFER(lookup_timer.set_hits(bfd_cache.hit_count() - hits));
+    auto &strings = bfd_cache.strings();
     for (int i = 0; i < addrs.size(); i++) {
       auto addr = addr_pairs[i].first;
-      auto line_info = line_infos[i];
-      bfd_cache.addr2symbol((void*)addr, [&](const char *file, const char *function,
-                                             const char *filename, unsigned int line) {
-                                           auto *func = get_demangled_symbol(function);
-                                           loc_cache_.insert({addr, new Location{.file_ = file, .function_ = func,
-                                                                                 .filename_ = line_info.filename_, .line_ = line_info.line_}});
-                                         });
+      auto &line_info = line_infos[i];
+      Location loc = bfd_cache.addr2location((void*)addr);
+      if (has_line(line_info)) {
+        loc.filename_ = strings.intern(line_info.filename_.c_str(), line_info.filename_.length());
+        loc.line_ = line_info.line_;
+      }
+      loc_cache_.insert({addr, loc});
+    }
+  }
+  LOG(DEBUG, "symbolize finish, locations: %ld, strings: %ld, string bytes: %ld",
+      loc_cache_.size(), bfd_cache.strings().size(), bfd_cache.strings().mem_used());
+}
+
+int ObStack::Modules::get(const string &key)
+{
+  auto it = ids_.insert({key, keys_.size()}).first;
+  if (it->second == keys_.size()) {
+    keys_.push_back(key);
+    maps_.push_back(Map{.path_ = key[0] == '/' ? key : "", .start_ = 0, .end_ = 0, .is_exe_ = false});
+  }
+  return it->second;
+}
+
+int ObStack::read_dump(const char *file, Modules &modules)
+{
+  StatsTimer timer("read dump", file, 0);
+  size_t n_bts = bts_.size();
+  FILE *fp = fopen(file, "rt");
+  if (!fp) {
+    LOG(ERROR, "open dump failed, file: %s, errno: %d", file, errno);
+    return -1;
+  }
+  DEFER(fclose(fp));
+  char line[8192];
+  while (fgets(line, sizeof(line), fp)) {
+    ulong start = 0, end = 0;
+    int is_exe = 0;
+    int pos = 0;
+    int tid = 0;
+    char build_id[128];
+    if (4 == sscanf(line, "map: 0x%lx-0x%lx %d %127s %n", &start, &end, &is_exe, build_id, &pos) && pos > 0) {
+      char *path = common::trim(line + pos);
+      auto &map = modules.maps_[modules.get(0 == strcmp(build_id, "-") ? path : build_id)];
+      map.path_ = path;
+      map.is_exe_ = 0 != is_exe;
+    } else if (1 == sscanf(line, "tid: %d, tname: %n", &tid, &pos) && pos > 0) {
+      char *tname = line + pos;
+      char *frames = strstr(tname, ", bt:");
+      if (!frames) continue;
+      *frames = '\0';
+      frames += strlen(", bt:");
+      std::vector<ulong> addrs;
+      for (char *frame = frames + strspn(frames, " \n"); *frame; frame += strspn(frame, " \n")) {
+        // module+0xoffset or a bare 0xaddr; a module path may hold spaces and
+        // "+0x", the frame runs on to the token with a "+0x" and ends at its last one
+        char *end = frame + strcspn(frame, " \n");
+        if (0 != strncmp(frame, "0x", 2)) {
+          while (' ' == *end && !memmem(frame, end - frame, "+0x", 3)) {
+            end += 1 + strcspn(end + 1, " \n");
+          }
+        }
+        char *plus = nullptr;
+        for (char *p = end; !plus && p - frame >= 3; p--) {
+          if (0 == memcmp(p - 3, "+0x", 3)) plus = p - 3;
+        }
+        if (plus) {
+          addrs.push_back(MODULE_BASE + modules.get(string(frame, plus)) * MODULE_SPAN + strtoul(plus + 3, nullptr, 16));
+        } else {
+          addrs.push_back(strtoul(frame, nullptr, 16));
+        }
+        frame = end;
+      }
+      add_bt(tid, tname, std::move(addrs));
+    }
+  }
+  timer.set_items(bts_.size() - n_bts);
+  LOG(INFO, "read dump finish, file: %s, modules: %ld, threads: %ld", file, modules.keys_.size(), bts_.size());
+  return 0;
+}
+
+/*
+ * Each module gets its own span of addresses, so dumps of different
+ * processes and hosts share one BFDCache. A build-id that the recorded path
+ * does not match is looked up among the installed debuginfo.
+ */
+void ObStack::load_modules(Modules &modules, const std::vector<bool> *used)
+{
+  for (int i = 0; i < modules.keys_.size(); i++) {
+    if (used && !(*used)[i]) continue;
+    auto &key = modules.keys_[i];
+    auto &map = modules.maps_[i];
+    if ('/' != key[0] && (map.path_.empty() || ELF_META.get(map.path_)->build_id_ != key)) {
+      string path = bfdutils::find_file_by_build_id(key);
+      if (!path.empty()) {
+        map.path_ = path;
+      } else {
+        LOG(WARN, "no file matches build-id, build-id: %s, file: %s", key.c_str(), map.path_.c_str());
+      }
+    }
+    if (map.path_.empty()) continue;
+    ulong base = MODULE_BASE + i * MODULE_SPAN;
+    map.start_ = base + ELF_META.get(map.path_)->load_vaddr_;
+    map.end_ = base + MODULE_SPAN;
+    maps_.push_back(map);
+  }
+  prepared_ = true;
+  load_maps(*bfd_cache_);
+}
+
+int ObStack::symbolize_dumps(char **files, int n_files)
+{
+  ObStack os(-1);
+  Modules modules;
+  std::vector<int> ends;
+  for (int i = 0; i < n_files; i++) {
+    if (0 != os.read_dump(files[i], modules)) {
+      return -1;
+    }
+    ends.push_back(os.bts_.size());
+  }
+  os.load_modules(modules);
+  std::unordered_set<ulong> addrs;
+  for (auto &&bt : os.bts_) {
+    addrs.insert(bt.addrs_.begin(), bt.addrs_.end());
+  }
+  int64_t s_ts = current_time();
+  os.symbolize(std::vector<ulong>(addrs.begin(), addrs.end()));
+  LOG(INFO, "symbolize finish, dumps: %d, modules: %ld, addrs: %ld, cost(ms): %f",
+      n_files, modules.keys_.size(), addrs.size(), (current_time() - s_ts)/1000.0);
+
+  std::vector<Bt> bts = std::move(os.bts_);
+  for (int i = 0; i < n_files; i++) {
+    os.bts_.assign(std::make_move_iterator(bts.begin() + (0 == i ? 0 : ends[i - 1])),
+                   std::make_move_iterator(bts.begin() + ends[i]));
+    if (FORMAT_NDJSON == CONF.format) {
+      OUTPUT.append("{\"dump\":");
+      OUTPUT.json_string(files[i]);
+      OUTPUT.append("}\n");
+    } else {
+      o_printf(COLOR_GREEN, "== %s ==\n", files[i]);
+    }
+    os.gen_result();
+  }
+  return 0;
+}
+
+int ObStack::load_core(const char *core_file, const char *exe_file)
+{
+  int64_t s_ts = current_time();
+  unwind::CoreFile core;
+  if (0 != core.open(core_file, exe_file)) {
+    return -1;
+  }
+  // one map per file with any executable mapping, same as read_maps
+  for (auto &&fm : core.file_maps()) {
+    if (!maps_.empty() && maps_.back().path_ == fm.path_ && fm.start_ >= maps_.back().start_) {
+      maps_.back().end_ = std::max(maps_.back().end_, fm.end_);
+      maps_.back().is_exe_ = maps_.back().is_exe_ || fm.exec_;
+    } else {
+      // is_exe_ is fixed up below, it holds the exec permission until then
+      maps_.push_back(Map{.path_ = fm.path_, .start_ = fm.start_, .end_ = fm.end_, .is_exe_ = fm.exec_});
+    }
+  }
+  maps_.erase(std::remove_if(maps_.begin(), maps_.end(), [](const Map &map) { return !map.is_exe_; }),
+              maps_.end());
+  for (auto &&map : maps_) {
+    map.is_exe_ = map.path_ == core.exe_path();
+  }
+  prepared_ = true;
+  load_maps(*bfd_cache_);
+  // page cache is charged to the memory cgroup too, leave it alone under --mem-limit
+  if (!CONF.no_parse && !CONF.no_lineno && 0 == CONF.mem_limit) {
+    prefetch_debug_files();
+  }
+
+  StatsTimer timer("unwind", "", core.threads().size());
+  unwind::Unwinder unwinder(core);
+  if (0 != unwinder.init()) {
+    return -1;
+  }
+  for (auto &&map : maps_) {
+    unwinder.add_module(map.start_, map.end_, ELF_META.get(map.path_));
+  }
+  ulong addrs[256];
+  char tname[32];
+  for (auto &&thread : core.threads()) {
+    if (CONF.thread_only && thread.tid_ != core.pid()) continue;
+    int n = unwinder.unwind(thread.regs_, addrs, ARRAYSIZE(addrs));
+    snprintf(tname, sizeof(tname), "%s", thread.name_.empty() ? core.name() : thread.name_.c_str());
+    add_bt(thread.tid_, tname, std::vector<ulong>(addrs, addrs + n));
+  }
+  LOG(INFO, "unwind core finish, threads: %ld, cost(ms): %f", bts_.size(), (current_time() - s_ts)/1000.0);
+  return 0;
+}
+
+/*
+ * Samples instead of a snapshot: each sample is a Bt of its thread and
+ * aggregation counts them. Modules are loaded first, the dwarf unwinder
+ * locates the unwind tables of each module from them.
+ */
+int ObStack::load_perf(const std::unordered_map<int, string> &tnames)
+{
+  int64_t s_ts = current_time();
+  prepare();
+  unwind::PerfSampler sampler(pid_, CONF.perf_dwarf);
+  std::vector<int> tids;
+  for (auto &&kv : tnames) {
+    tids.push_back(kv.first);
+  }
+  int rc = sampler.open(tids, CONF.perf_freq);
+  if (0 != rc) {
+    return rc;
+  }
+  for (auto &&map : maps_) {
+    sampler.add_module(map.start_, map.end_, ELF_META.get(map.path_));
+  }
+  StatsTimer timer("sample", "", 0);
+  rc = sampler.run(CONF.perf_ms * 1000, [&](int tid, const ulong *addrs, int n) {
+                                          auto it = tnames.find(tid);
+                                          bts_.push_back({.pid_ = pid_, .tid_ = tid,
+                                                .tname_ = it == tnames.end() ? "" : it->second,
+                                                .addrs_ = std::vector<ulong>(addrs, addrs + n)});
+                                        });
+  timer.set_items(sampler.samples());
+  LOG(INFO, "perf sampling finish, samples: %ld, lost: %ld, cost(ms): %f",
+      sampler.samples(), sampler.lost(), (current_time() - s_ts)/1000.0);
+  return rc;
+}
+
+int ObStack::diff(const char *before_file, const char *after_file)
+{
+  enum Change { APPEARED, DISAPPEARED, GREW, SHRANK, KEPT, CHANGE_MAX };
+  static const char *CHANGE_NAMES[] = {"appeared", "disappeared", "grew", "shrank", "kept"};
+  struct Entry
+  {
+    Group groups_[2];
+    Change change_;
+    int rep_side_;
+  };
+  // both dumps share the modules, a frame is the same module-relative
+  // address on either side, even when the process was restarted in between
+  ObStack os(-1);
+  Modules modules;
+  if (0 != os.read_dump(before_file, modules)) {
+    return -1;
+  }
+  int n_before = os.bts_.size();
+  if (0 != os.read_dump(after_file, modules)) {
+    return -1;
+  }
+
+  std::unordered_map<std::vector<ulong>, int, common::U64VecHash> key_map;
+  std::vector<Entry> entries;
+  std::unordered_map<int, std::pair<int, int>> before_tids; // tid => entry, bt
+  for (int i = 0; i < os.bts_.size(); i++) {
+    int side = i < n_before ? 0 : 1;
+    auto it = key_map.find(os.bts_[i].addrs_);
+    if (it == key_map.end()) {
+      it = key_map.insert({os.bts_[i].addrs_, entries.size()}).first;
+      entries.push_back(Entry());
+    }
+    entries[it->second].groups_[side].bt_idxs_.push_back(i);
+    if (0 == side) {
+      before_tids.insert({os.bts_[i].tid_, {it->second, i}});
+    }
+  }
+
+  // threads that kept an identical stack form groups of their own, and
+  // leave the groups of their entry, which only count the other threads
+  std::vector<Entry> kept;
+  std::unordered_map<int, int> kept_map; // entry => kept entry
+  for (int i = n_before; i < os.bts_.size(); i++) {
+    auto &bt = os.bts_[i];
+    auto it = before_tids.find(bt.tid_);
+    if (it == before_tids.end()) continue;
+    auto &entry = entries[it->second.first];
+    auto &after_idxs = entry.groups_[1].bt_idxs_;
+    auto a_it = std::find(after_idxs.begin(), after_idxs.end(), i);
+    if (a_it == after_idxs.end()) continue;
+    after_idxs.erase(a_it);
+    auto &before_idxs = entry.groups_[0].bt_idxs_;
+    before_idxs.erase(std::find(before_idxs.begin(), before_idxs.end(), it->second.second));
+    auto k_it = kept_map.insert({it->second.first, kept.size()}).first;
+    before_tids.erase(it);
+    if (k_it->second == kept.size()) {
+      kept.push_back(Entry{.groups_ = {}, .change_ = KEPT, .rep_side_ = 1});
+    }
+    kept[k_it->second].groups_[1].bt_idxs_.push_back(i);
+  }
+
+  std::vector<Entry*> changed;
+  for (auto &&entry : entries) {
+    int b = entry.groups_[0].bt_idxs_.size();
+    int a = entry.groups_[1].bt_idxs_.size();
+    if (a == b) continue;
+    entry.change_ = 0 == b ? APPEARED : 0 == a ? DISAPPEARED : a > b ? GREW : SHRANK;
+    entry.rep_side_ = a > 0 ? 1 : 0;
+    changed.push_back(&entry);
+  }
+  for (auto &&entry : kept) {
+    changed.push_back(&entry);
+  }
+  std::stable_sort(changed.begin(), changed.end(), [](const Entry *l, const Entry *r) {
+                                                     auto delta = [](const Entry *e) {
+                                                                    return std::abs((long)e->groups_[1].bt_idxs_.size() -
+                                                                                    (long)e->groups_[0].bt_idxs_.size());
+                                                                  };
+                                                     return l->change_ < r->change_ ||
+                                                       (l->change_ == r->change_ && delta(l) > delta(r));
+                                                   });
+
+  // load and symbolize only the modules and stacks in the diff
+  std::unordered_set<ulong> addr_set;
+  std::vector<bool> used(modules.keys_.size(), false);
+  for (auto *entry : changed) {
+    auto &addrs = os.bts_[entry->groups_[entry->rep_side_].bt_idxs_[0]].addrs_;
+    addr_set.insert(addrs.begin(), addrs.end());
+    for (auto addr : addrs) {
+      if (addr >= MODULE_BASE) {
+        used[(addr - MODULE_BASE) / MODULE_SPAN] = true;
+      }
+    }
+  }
+  os.load_modules(modules, &used);
+  os.symbolize(std::vector<ulong>(addr_set.begin(), addr_set.end()));
+
+  int counts[CHANGE_MAX] = {};
+  for (auto *entry : changed) {
+    counts[entry->change_]++;
+  }
+  int last_change = -1;
+  for (auto *entry : changed) {
+    auto &group = entry->groups_[entry->rep_side_];
+    auto &addrs = os.bts_[group.bt_idxs_[0]].addrs_;
+    int b = KEPT == entry->change_ ? group.bt_idxs_.size() : entry->groups_[0].bt_idxs_.size();
+    int a = group.bt_idxs_.size();
+    if (FORMAT_NDJSON == CONF.format) {
+      OUTPUT.append("{\"change\":\"%s\",\"before\":%d,\"after\":%d,\"threads\":[",
+                    CHANGE_NAMES[entry->change_], b, KEPT == entry->change_ ? a : (int)entry->groups_[1].bt_idxs_.size());
+      for (int i = 0; i < group.bt_idxs_.size(); i++) {
+        auto &bt = os.bts_[group.bt_idxs_[i]];
+        OUTPUT.append("%s{\"tid\":%d,\"name\":", 0 == i ? "" : ",", bt.tid_);
+        OUTPUT.json_string(bt.tname_.c_str());
+        OUTPUT.put('}');
+      }
+      OUTPUT.append("],");
+      os.print_frames_json(addrs);
+      OUTPUT.append("}\n");
+      OUTPUT.end_record();
+      continue;
+    }
+    if (entry->change_ != last_change) {
+      last_change = entry->change_;
+      o_printf(COLOR_GREEN, "== %s: %d %s ==\n", CHANGE_NAMES[entry->change_], counts[entry->change_],
+               KEPT == entry->change_ ? "stacks kept by the same threads" : "stacks");
+    }
+    o_printf(COLOR_YELLOW, "Threads %d -> %d (", b,
+             KEPT == entry->change_ ? a : (int)entry->groups_[1].bt_idxs_.size());
+    for (int i = 0; i < group.bt_idxs_.size(); i++) {
+      auto &bt = os.bts_[group.bt_idxs_[i]];
+      o_printf(COLOR_YELLOW, "%s%d-%s", 0 == i ? "" : ", ", bt.tid_, bt.tname_.c_str());
+    }
+    o_printf(COLOR_YELLOW, ")\n");
+    os.print_stack_frames(addrs);
+  }
+  OUTPUT.flush();
+  return 0;
+}
+
+int ObStack::stack_it()
+{
+  prepare();
+  if (CONF.no_parse) {
+    StatsTimer timer("output", "", bts_.size());
+    if (FORMAT_TEXT == CONF.format) {
+      print_maps();
+    }
+    for (auto &&bt : bts_) {
+      print_thread(bt);
+    }
+    OUTPUT.flush();
+    return 0;
+  }
+  std::unordered_set<ulong> addr_set;
+  for (auto &&bt : bts_) {
+    addr_set.insert(bt.addrs_.begin(), bt.addrs_.end());
+  }
+  LOG(DEBUG, "aggregated addrs count: %d", addr_set.size());
+  symbolize(std::vector<ulong>(addr_set.begin(), addr_set.end()));
+  if (CONF.deadlock) {
+    print_locks();
+  }
+  if (proc_maps_.size() <= 1 || CONF.merge) {
+    print_result();
+    return 0;
+  }
+  // one section per process, threads were added process by process
+  std::vector<Bt> bts = std::move(bts_);
+  for (int begin = 0, end = 0; begin < bts.size(); begin = end) {
+    while (end < bts.size() && bts[end].pid_ == bts[begin].pid_) end++;
+    bts_.assign(std::make_move_iterator(bts.begin() + begin), std::make_move_iterator(bts.begin() + end));
+    if (FORMAT_NDJSON == CONF.format) {
+      OUTPUT.append("{\"pid\":%d}\n", bts_[0].pid_);
+    } else {
+      o_printf(COLOR_GREEN, "== pid %d ==\n", bts_[0].pid_);
     }
+    print_result();
   }
-  gen_result();
   return 0;
 }
 }
@@ -22,16 +22,16 @@
 #include <unordered_set>
 #include <vector>
 #include <string>
+#include "bfd/location.h"
 
 namespace _obstack
 {
 namespace bfdutils
 {
 class BFDCache;
-class Location;
+struct ElfMeta;
 }
 
-class LineInfo;
 class ObStack
 {
  struct Map
@@ -40,29 +40,104 @@ class ObStack
    ulong start_;
    ulong end_;
    bool is_exe_;
+   // as in /proc/<pid>/maps, a file replaced under path_ shows up as another inode
+   ulong inode_;
+   ulong dev_;
+   ulong first_end_; // of the first mapping, named start_-first_end_ in /proc/<pid>/map_files
  };
  struct Bt
  {
+   int pid_;
    int tid_;
    std::string tname_;
-   std::vector<ulong> addrs_;
-   std::string bt_;
+   std::vector<ulong> addrs_;     // symbolization keys, module-relative with several processes
+   std::vector<ulong> abs_addrs_; // several processes only, the addresses as captured
+   bool has_load_; // --top only
+   float cpu_pct_;
+   float run_delay_ms_;
+   ulong futex_;   // --futex only
+   int lock_owner_;
+ };
+ struct Group
+ {
+   std::vector<int> bt_idxs_;
+   float cpu_pct_;
+   float run_delay_ms_;
+ };
+ // modules of dumps or of several processes, keyed by build-id, or by path without one
+ struct Modules
+ {
+   std::vector<std::string> keys_;
+   std::vector<Map> maps_;
+   std::unordered_map<std::string, int> ids_;
+   int get(const std::string &key);
  };
 public:
   ObStack(int pid);
+  ~ObStack();
+  // owns bfd_cache_
+  ObStack(const ObStack &) = delete;
+  ObStack &operator=(const ObStack &) = delete;
+  void prepare();
+  // next capture of the same process, see --repeat: reload only the modules whose mappings changed
+  void update_maps();
+  // drop the threads of the previous capture, modules and symbolized frames stay cached
+  void clear_threads() { bts_.clear(); }
   int stack_it();
-  void add_bt(int tid, char *tname, std::vector<ulong> &&addrs, std::string &&bt);
+  void add_bt(int tid, char *tname, std::vector<ulong> &&addrs);
+  // several live processes in one ObStack: frames become module-relative, so
+  // a file mapped by all of them is loaded and symbolized once
+  void add_process(int pid);
+  void add_bt(int pid, int tid, char *tname, std::vector<ulong> &&addrs);
+  // cpu usage and run queue delay of the thread added last, printed with its stack
+  void set_load(float cpu_pct, float run_delay_ms);
+  // futex address the thread added last waits on, 0 if none, and the tid
+  // holding the lock behind it, 0 if unknown
+  void set_futex(ulong futex, int lock_owner);
+  // unwind the threads of a core file instead of a live process
+  int load_core(const char *core_file, const char *exe_file);
+  // sample the running threads of pid_ with perf events, every sample is added as a thread
+  int load_perf(const std::unordered_map<int, std::string> &tnames);
+  // compare two --no_parse dumps, symbolizing only the stacks that differ
+  static int diff(const char *before_file, const char *after_file);
+  // symbolize many --no_parse dumps at once, every debug file is read once
+  static int symbolize_dumps(char **files, int n_files);
 private:
-  void read_maps(int pid);
+  void read_maps(int pid, std::vector<Map> &maps);
+  bool is_replaced(const bfdutils::ElfMeta &meta, const Map &map) const;
+  int read_dump(const char *file, Modules &modules);
+  // with used, only the modules flagged in it
+  void load_modules(Modules &modules, const std::vector<bool> *used=nullptr);
   void load_maps(bfdutils::BFDCache &bfd_cache);
+  void load_perf_map(bfdutils::BFDCache &bfd_cache);
+  void prefetch_debug_files();
+  void symbolize(const std::vector<ulong> &abs_addrs);
   void gen_result();
+  void print_result();
+  void print_locks();
+  std::string data_symbol(int pid, ulong addr);
+  void aggregate(std::vector<Group> &groups);
+  void print_group(const Group &group);
   template<typename Addrs>
-  void print_stack_frames(Addrs &addrs, bool witnh_frame_no=true);
+  void print_stack_frames(Addrs &addrs, bool witnh_frame_no=true, const std::vector<ulong> *abs_addrs=nullptr);
+  void print_frames_json(const std::vector<ulong> &addrs, const std::vector<ulong> *abs_addrs=nullptr);
+  static const std::vector<ulong> *abs_addrs(const Bt &bt)
+  {
+    return bt.abs_addrs_.empty() ? nullptr : &bt.abs_addrs_;
+  }
+  void print_thread(const Bt &bt);
+  void print_maps();
+  const Map *find_map(ulong addr) const;
+  const char *str(uint32_t id) const;
 private:
   int pid_;
+  bool prepared_;
+  bfdutils::BFDCache *bfd_cache_;
   std::vector<Map> maps_;
   std::vector<Bt> bts_;
-  std::unordered_map<ulong, bfdutils::Location*> loc_cache_;
+  std::unordered_map<ulong, bfdutils::Location> loc_cache_;
+  Modules modules_;
+  std::unordered_map<int, std::vector<Map>> proc_maps_;
 };
 }
 
@@ -0,0 +1,267 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "unwind/core_file.h"
+#include "unwind/raw_snapshot.h"
+
+#include <fcntl.h>
+#include <link.h>
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/procfs.h>
+#include "bfd/elf_meta.h"
+#include "common/log.h"
+#include "utils/defer.h"
+
+using namespace std;
+
+namespace _obstack
+{
+namespace unwind
+{
+#define IN_IMAGE(off, len) ((ulong)(off) + (ulong)(len) <= size_)
+
+CoreFile::CoreFile()
+  : image_(nullptr), size_(0), pid_(-1), entry_(0)
+{
+  name_[0] = '\0';
+}
+
+CoreFile::~CoreFile()
+{
+  if (image_) {
+    munmap((void *)image_, size_);
+  }
+}
+
+int CoreFile::open(const char *core_file, const char *exe_file)
+{
+  int fd = ::open(core_file, O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR, "open core failed, file: %s, errno: %d", core_file, errno);
+    return -1;
+  }
+  DEFER(::close(fd));
+  struct stat sb;
+  if (0 != fstat(fd, &sb) || sb.st_size <= 0) {
+    LOG(ERROR, "stat core failed, file: %s, errno: %d", core_file, errno);
+    return -1;
+  }
+  void *image = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (MAP_FAILED == image) {
+    LOG(ERROR, "mmap core failed, file: %s, errno: %d", core_file, errno);
+    return -1;
+  }
+  image_ = (const char *)image;
+  size_ = sb.st_size;
+
+  auto *ehdr = (const ElfW(Ehdr)*)image_;
+  if (!IN_IMAGE(0, sizeof(ElfW(Ehdr))) || 0 != memcmp(ehdr->e_ident, ELFMAG, SELFMAG) || ET_CORE != ehdr->e_type) {
+    LOG(ERROR, "not a core file, file: %s", core_file);
+    return -1;
+  }
+  // extended numbering, the count is in sh_info of section 0
+  ulong phnum = ehdr->e_phnum;
+  if (PN_XNUM == phnum && ehdr->e_shnum > 0 && IN_IMAGE(ehdr->e_shoff, sizeof(ElfW(Shdr)))) {
+    phnum = ((const ElfW(Shdr)*)(image_ + ehdr->e_shoff))->sh_info;
+  }
+  if (!IN_IMAGE(ehdr->e_phoff, phnum * sizeof(ElfW(Phdr)))) {
+    LOG(ERROR, "not a core file, file: %s", core_file);
+    return -1;
+  }
+  auto *phdr = (const ElfW(Phdr)*)(image_ + ehdr->e_phoff);
+  for (ulong i = 0; i < phnum; i++) {
+    auto &p = phdr[i];
+    if (PT_LOAD == p.p_type) {
+      // bytes beyond the end of the core (a truncated dump) were not dumped
+      ulong filesz = IN_IMAGE(p.p_offset, p.p_filesz) ? p.p_filesz : p.p_offset < size_ ? size_ - p.p_offset : 0;
+      segments_.push_back({.vaddr_ = p.p_vaddr, .memsz_ = p.p_memsz, .offset_ = p.p_offset,
+                           .filesz_ = filesz, .flags_ = p.p_flags});
+    }
+  }
+  std::sort(segments_.begin(), segments_.end(), [](const Segment &l, const Segment &r) { return l.vaddr_ < r.vaddr_; });
+  for (ulong i = 0; i < phnum; i++) {
+    if (PT_NOTE == phdr[i].p_type && IN_IMAGE(phdr[i].p_offset, phdr[i].p_filesz)) {
+      parse_notes(phdr[i].p_offset, phdr[i].p_filesz);
+    }
+  }
+  if (threads_.empty()) {
+    LOG(ERROR, "no thread found in core, file: %s", core_file);
+    return -1;
+  }
+  if (file_maps_.empty()) {
+    LOG(WARN, "no NT_FILE note in core, only the executable is known, file: %s", core_file);
+    auto *meta = exe_file ? ELF_META.get(exe_file) : nullptr;
+    if (meta && meta->is_exec_) {
+      for (auto &&seg : meta->segments_) {
+        file_maps_.push_back({.start_ = seg.vaddr_, .end_ = seg.vaddr_ + seg.memsz_,
+                              .offset_ = seg.offset_, .exec_ = 0 != (seg.flags_ & PF_X), .path_ = exe_file});
+      }
+    }
+  } else {
+    std::sort(file_maps_.begin(), file_maps_.end(), [](const FileMap &l, const FileMap &r) { return l.start_ < r.start_; });
+  }
+
+  // the executable is the file that maps the entry point
+  auto *exe_map = find_file_map(entry_);
+  if (!exe_map && !file_maps_.empty()) {
+    exe_map = &file_maps_[0];
+  }
+  if (exe_map) {
+    string recorded = exe_map->path_;
+    exe_path_ = exe_file ? exe_file : recorded;
+    for (auto &&map : file_maps_) {
+      if (map.path_ == recorded) map.path_ = exe_path_;
+    }
+    for (auto &&build_id : build_ids_) {
+      if (build_id.first == recorded) build_id.first = exe_path_;
+    }
+  }
+  check_build_ids();
+  LOG(INFO, "core loaded, file: %s, pid: %d, name: %s, exe: %s, threads: %ld, segments: %ld, file maps: %ld",
+      core_file, pid_, name_, exe_path_.c_str(), threads_.size(), segments_.size(), file_maps_.size());
+  return 0;
+}
+
+void CoreFile::parse_notes(ulong off, ulong size)
+{
+  ulong end = off + size;
+  while (off + sizeof(ElfW(Nhdr)) <= end) {
+    auto *nhdr = (const ElfW(Nhdr)*)(image_ + off);
+    ulong name_off = off + sizeof(ElfW(Nhdr));
+    ulong desc_off = name_off + ((nhdr->n_namesz + 3) & ~3UL);
+    ulong next_off = desc_off + ((nhdr->n_descsz + 3) & ~3UL);
+    if (desc_off + nhdr->n_descsz > end) break;
+    const char *desc = image_ + desc_off;
+    const char *name = image_ + name_off;
+    if (sizeof(OBSTACK_NOTE_NAME) == nhdr->n_namesz && 0 == memcmp(name, OBSTACK_NOTE_NAME, nhdr->n_namesz)) {
+      parse_obstack_note(nhdr->n_type, desc, nhdr->n_descsz);
+    } else if (NT_PRSTATUS == nhdr->n_type && nhdr->n_descsz >= sizeof(prstatus_t)) {
+      auto *status = (const prstatus_t *)desc;
+      Thread thread;
+      thread.tid_ = status->pr_pid;
+      static_assert(sizeof(status->pr_reg) >= sizeof(thread.regs_), "unexpected elf_gregset_t");
+      memcpy(&thread.regs_, &status->pr_reg, sizeof(thread.regs_));
+      threads_.push_back(thread);
+    } else if (NT_PRPSINFO == nhdr->n_type && nhdr->n_descsz >= sizeof(prpsinfo_t)) {
+      auto *info = (const prpsinfo_t *)desc;
+      pid_ = info->pr_pid;
+      snprintf(name_, sizeof(name_), "%.*s", (int)sizeof(info->pr_fname), info->pr_fname);
+    } else if (NT_AUXV == nhdr->n_type) {
+      for (ulong i = 0; i + 2 * sizeof(ulong) <= nhdr->n_descsz; i += 2 * sizeof(ulong)) {
+        ulong av[2];
+        memcpy(av, desc + i, sizeof(av));
+        if (AT_ENTRY == av[0]) entry_ = av[1];
+      }
+    } else if (NT_FILE == nhdr->n_type) {
+      parse_file_note(desc, nhdr->n_descsz);
+    }
+    off = next_off;
+  }
+}
+
+void CoreFile::parse_obstack_note(uint type, const char *desc, ulong size)
+{
+  const char *end = desc + size;
+  if (NT_OBSTACK_THREAD_NAME == type && size > sizeof(int)) {
+    int tid;
+    memcpy(&tid, desc, sizeof(tid));
+    // follows the NT_PRSTATUS of the same thread
+    if (!threads_.empty() && threads_.back().tid_ == tid) {
+      threads_.back().name_ = string(desc + sizeof(tid), strnlen(desc + sizeof(tid), size - sizeof(tid)));
+    }
+  } else if (NT_OBSTACK_BUILD_ID == type) {
+    size_t len = strnlen(desc, size);
+    if (len + 1 < size) {
+      const char *id = desc + len + 1;
+      build_ids_.push_back({string(desc, len), string(id, strnlen(id, end - id))});
+    }
+  }
+}
+
+void CoreFile::check_build_ids()
+{
+  for (auto &&build_id : build_ids_) {
+    auto *meta = ELF_META.get(build_id.first);
+    if (meta->build_id_ != build_id.second) {
+      LOG(WARN, "build-id mismatch, symbols may be wrong, file: %s, saved: %s, found: %s",
+          build_id.first.c_str(), build_id.second.c_str(), meta->build_id_.c_str());
+    }
+  }
+}
+
+// count, page size, count * (start, end, offset in pages), count * path
+void CoreFile::parse_file_note(const char *desc, ulong size)
+{
+  ulong header[2];
+  if (size < sizeof(header)) return;
+  memcpy(header, desc, sizeof(header));
+  ulong count = header[0];
+  ulong page_size = header[1];
+  ulong names_off = sizeof(header) + count * 3 * sizeof(ulong);
+  if (names_off > size) return;
+  const char *name = desc + names_off;
+  const char *end = desc + size;
+  for (ulong i = 0; i < count && name < end; i++) {
+    ulong entry[3];
+    memcpy(entry, desc + sizeof(header) + i * sizeof(entry), sizeof(entry));
+    size_t len = strnlen(name, end - name);
+    auto *seg = find_segment(entry[0]);
+    file_maps_.push_back({.start_ = entry[0], .end_ = entry[1], .offset_ = entry[2] * page_size,
+                          .exec_ = seg && 0 != (seg->flags_ & PF_X), .path_ = string(name, len)});
+    name += len + 1;
+  }
+}
+
+const CoreFile::Segment *CoreFile::find_segment(ulong addr) const
+{
+  auto it = std::upper_bound(segments_.begin(), segments_.end(), addr,
+                             [](ulong addr, const Segment &s) { return addr < s.vaddr_ + s.memsz_; });
+  return it != segments_.end() && addr >= it->vaddr_ ? &*it : nullptr;
+}
+
+const CoreFile::FileMap *CoreFile::find_file_map(ulong addr) const
+{
+  auto it = std::upper_bound(file_maps_.begin(), file_maps_.end(), addr,
+                             [](ulong addr, const FileMap &m) { return addr < m.end_; });
+  return it != file_maps_.end() && addr >= it->start_ ? &*it : nullptr;
+}
+
+int CoreFile::read(ulong addr, void *buf, size_t len)
+{
+  auto *seg = find_segment(addr);
+  if (seg && addr + len <= seg->vaddr_ + seg->filesz_) {
+    memcpy(buf, image_ + seg->offset_ + (addr - seg->vaddr_), len);
+    return 0;
+  }
+  auto *map = find_file_map(addr);
+  if (map && addr + len <= map->end_) {
+    auto *meta = ELF_META.get(map->path_);
+    ulong off = map->offset_ + (addr - map->start_);
+    if (meta->image_ && off + len <= meta->size_) {
+      memcpy(buf, meta->image_ + off, len);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+}
+}
@@ -0,0 +1,97 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNWIND_CORE_FILE_H_
+#define UNWIND_CORE_FILE_H_
+
+#include <string>
+#include <vector>
+#include "unwind/unwinder.h"
+
+namespace _obstack
+{
+namespace unwind
+{
+using std::string;
+
+/*
+ * An ELF core file, e.g. written by the kernel or by gcore. Threads come from
+ * the NT_PRSTATUS notes, file mappings from NT_FILE. Memory is read from the
+ * core segments, and from the mapped files for what the core did not dump
+ * (usually the text of every module). Raw snapshots written by --save_raw
+ * are cores too, with thread names and build-ids in extra notes.
+ */
+class CoreFile : public Memory
+{
+public:
+  struct Thread
+  {
+    int tid_;
+    string name_; // empty unless saved by --save_raw
+    Regs regs_;
+  };
+  struct FileMap
+  {
+    ulong start_;
+    ulong end_;
+    ulong offset_;
+    bool exec_;
+    string path_;
+  };
+private:
+  struct Segment
+  {
+    ulong vaddr_;
+    ulong memsz_;
+    ulong offset_;
+    ulong filesz_;
+    uint flags_;
+  };
+public:
+  CoreFile();
+  ~CoreFile();
+  // exe_file, if not null, replaces the executable recorded in the core
+  int open(const char *core_file, const char *exe_file);
+  int read(ulong addr, void *buf, size_t len) override;
+  int pid() const { return pid_; }
+  const char *name() const { return name_; }
+  const string &exe_path() const { return exe_path_; }
+  const std::vector<Thread> &threads() const { return threads_; }
+  const std::vector<FileMap> &file_maps() const { return file_maps_; }
+private:
+  void parse_notes(ulong off, ulong size);
+  void parse_file_note(const char *desc, ulong size);
+  void parse_obstack_note(uint type, const char *desc, ulong size);
+  void check_build_ids();
+  const Segment *find_segment(ulong addr) const;
+  const FileMap *find_file_map(ulong addr) const;
+private:
+  const char *image_;
+  size_t size_;
+  int pid_;
+  char name_[16];
+  ulong entry_;
+  string exe_path_;
+  std::vector<Segment> segments_;
+  std::vector<Thread> threads_;
+  std::vector<FileMap> file_maps_;
+  std::vector<std::pair<string, string>> build_ids_; // path, build-id
+};
+}
+}
+
+#endif // UNWIND_CORE_FILE_H_
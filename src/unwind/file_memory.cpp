@@ -0,0 +1,105 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "unwind/file_memory.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <libunwind-ptrace.h>
+#include "bfd/elf_meta.h"
+#include "common/log.h"
+#include "utils/defer.h"
+
+namespace _obstack
+{
+namespace unwind
+{
+void FileMemory::load(int pid)
+{
+  maps_.clear();
+  char fn[64];
+  snprintf(fn, sizeof(fn), "/proc/%d/maps", pid);
+  FILE *map_file = fopen(fn, "rt");
+  if (!map_file) return;
+  DEFER(fclose(map_file));
+  char line[1024];
+  char perms[8];
+  char path[512];
+  while (fgets(line, sizeof(line), map_file)) {
+    ulong start, end, offset, inode;
+    uint dev_major, dev_minor;
+    if (8 != sscanf(line, "%lx-%lx %7s %lx %x:%x %lu %511s",
+                    &start, &end, perms, &offset, &dev_major, &dev_minor, &inode, path)) {
+      continue;
+    }
+    if (0 == inode || 'w' == perms[1] || '/' != path[0]) continue;
+    // replaced on disk since it was mapped, e.g. an upgraded binary
+    struct stat st;
+    if (0 != stat(path, &st) || st.st_ino != inode || major(st.st_dev) != dev_major || minor(st.st_dev) != dev_minor) {
+      LOG(DEBUG, "not the mapped file, read remotely, file: %s", path);
+      continue;
+    }
+    auto *meta = ELF_META.get(path);
+    if (!meta->valid_) continue;
+    maps_.push_back(Map{.start_ = start, .end_ = end, .offset_ = offset, .meta_ = meta});
+  }
+}
+
+int FileMemory::read(ulong addr, void *buf, size_t len)
+{
+  auto it = std::upper_bound(maps_.begin(), maps_.end(), addr,
+                             [](ulong addr, const Map &m) { return addr < m.end_; });
+  if (it == maps_.end() || addr < it->start_ || addr + len > it->end_) {
+    return -1;
+  }
+  ulong off = it->offset_ + (addr - it->start_);
+  for (auto &&seg : it->meta_->segments_) {
+    if (off < seg.offset_ || off >= seg.offset_ + seg.filesz_) continue;
+    if (0 == it->meta_->read(seg.vaddr_ + (off - seg.offset_), buf, len)) {
+      local_reads_++;
+      return 0;
+    }
+    break;
+  }
+  return -1;
+}
+
+static FileMemory *upt_mem = nullptr;
+
+static int access_mem(unw_addr_space_t as, unw_word_t addr, unw_word_t *valp, int write, void *arg)
+{
+  if (!write && upt_mem) {
+    if (0 == upt_mem->read(addr, valp, sizeof(*valp))) {
+      return 0;
+    }
+    upt_mem->count_remote_read();
+  }
+  return _UPT_access_mem(as, addr, valp, write, arg);
+}
+
+unw_accessors_t *upt_accessors(FileMemory *mem)
+{
+  static unw_accessors_t accessors = _UPT_accessors;
+  accessors.access_mem = access_mem;
+  upt_mem = mem;
+  return &accessors;
+}
+}
+}
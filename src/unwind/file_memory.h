@@ -0,0 +1,68 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNWIND_FILE_MEMORY_H_
+#define UNWIND_FILE_MEMORY_H_
+
+#include <vector>
+#include <libunwind.h>
+#include "unwind/unwinder.h"
+
+namespace _obstack
+{
+namespace unwind
+{
+/*
+ * Read-only, file-backed memory of a live process, served from the local
+ * ELF images instead of the target. A mapping counts only if the local
+ * path still has the inode of /proc/<pid>/maps and the bytes fall in a
+ * PT_LOAD without PF_W, so relocated data such as RELRO always comes from
+ * the target. Everything else, e.g. stacks, fails and is read remotely.
+ */
+class FileMemory : public Memory
+{
+  struct Map
+  {
+    ulong start_;
+    ulong end_;
+    ulong offset_;
+    const bfdutils::ElfMeta *meta_;
+  };
+public:
+  FileMemory() : local_reads_(0), remote_reads_(0) {}
+  // the mappings of pid, replacing those of the previous one
+  void load(int pid);
+  int read(ulong addr, void *buf, size_t len) override;
+  int64_t local_reads() const { return local_reads_; }
+  int64_t remote_reads() const { return remote_reads_; }
+  void count_remote_read() { remote_reads_++; }
+private:
+  std::vector<Map> maps_;
+  int64_t local_reads_;
+  int64_t remote_reads_;
+};
+
+/*
+ * _UPT_accessors whose access_mem tries mem first. The UPT_info stays the
+ * accessor argument, the ptrace internals pass it around, so mem is
+ * remembered here: one FileMemory at a time, the tracer is single threaded.
+ */
+unw_accessors_t *upt_accessors(FileMemory *mem);
+}
+}
+
+#endif // UNWIND_FILE_MEMORY_H_
@@ -0,0 +1,288 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "unwind/perf_sampler.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/perf_event.h>
+#include <asm/perf_regs.h>
+#include "bfd/elf_meta.h"
+#include "common/log.h"
+#include "utils/util.h"
+#include "lib/macro_utils.h"
+
+namespace _obstack
+{
+namespace unwind
+{
+// ring buffer pages besides the header page, a power of two
+static const int FP_DATA_PAGES = 8;
+static const int DWARF_DATA_PAGES = 32;
+static const int64_t DRAIN_INTERVAL_US = 10000;
+
+#if defined(__x86_64__)
+// perf register number of each Regs member the unwinder reads
+#define REG(name, perf) {offsetof(Regs, name), PERF_REG_X86_##perf}
+static const struct { size_t offset_; int perf_; } REG_MAP[] = {
+  REG(rax, AX), REG(rbx, BX), REG(rcx, CX), REG(rdx, DX), REG(rsi, SI), REG(rdi, DI),
+  REG(rbp, BP), REG(rsp, SP), REG(rip, IP), REG(r8, R8), REG(r9, R9), REG(r10, R10),
+  REG(r11, R11), REG(r12, R12), REG(r13, R13), REG(r14, R14), REG(r15, R15)
+};
+#undef REG
+#elif defined(__aarch64__)
+// x0-x30, sp and pc, the same order as Regs
+static const struct { size_t offset_; int perf_; } REG_MAP[] = {
+  {0x00, 0}, {0x08, 1}, {0x10, 2}, {0x18, 3}, {0x20, 4}, {0x28, 5}, {0x30, 6}, {0x38, 7},
+  {0x40, 8}, {0x48, 9}, {0x50, 10}, {0x58, 11}, {0x60, 12}, {0x68, 13}, {0x70, 14}, {0x78, 15},
+  {0x80, 16}, {0x88, 17}, {0x90, 18}, {0x98, 19}, {0xa0, 20}, {0xa8, 21}, {0xb0, 22}, {0xb8, 23},
+  {0xc0, 24}, {0xc8, 25}, {0xd0, 26}, {0xd8, 27}, {0xe0, 28}, {0xe8, 29}, {0xf0, 30}, {0xf8, 31},
+  {0x100, 32}
+};
+#else
+#error "architecture not supported"
+#endif
+
+static ulong regs_mask()
+{
+  ulong mask = 0;
+  for (auto &&reg : REG_MAP) {
+    mask |= 1UL << reg.perf_;
+  }
+  return mask;
+}
+
+static int perf_event_open(struct perf_event_attr *attr, int tid)
+{
+  return syscall(SYS_perf_event_open, attr, tid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+PerfSampler::PerfSampler(int pid, bool dwarf)
+  : pid_(pid), dwarf_(dwarf), unwinder_(*this), stack_start_(0), stack_(nullptr), stack_len_(0),
+    samples_(0), lost_(0)
+{}
+
+PerfSampler::~PerfSampler()
+{
+  for (auto &&ring : rings_) {
+    munmap(ring.base_, ring.size_);
+    close(ring.fd_);
+  }
+}
+
+void PerfSampler::add_module(ulong start, ulong end, const bfdutils::ElfMeta *meta)
+{
+  unwinder_.add_module(start, end, meta);
+  auto it = std::upper_bound(modules_.begin(), modules_.end(), start,
+                             [](ulong addr, const Module &m) { return addr < m.start_; });
+  modules_.insert(it, Module{.start_ = start, .end_ = end, .meta_ = meta});
+}
+
+int PerfSampler::open(const std::vector<int> &tids, int freq)
+{
+  if (dwarf_ && 0 != unwinder_.init()) {
+    return ENOMEM;
+  }
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_SOFTWARE;
+  attr.config = PERF_COUNT_SW_TASK_CLOCK;
+  attr.freq = 1;
+  attr.sample_freq = freq;
+  attr.sample_type = PERF_SAMPLE_TID;
+  if (dwarf_) {
+    attr.sample_type |= PERF_SAMPLE_REGS_USER | PERF_SAMPLE_STACK_USER;
+    attr.sample_regs_user = regs_mask();
+    attr.sample_stack_user = STACK_SIZE;
+  } else {
+    attr.sample_type |= PERF_SAMPLE_CALLCHAIN;
+    attr.exclude_callchain_kernel = 1;
+  }
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  long page_size = getpagesize();
+  size_t size = (1 + (dwarf_ ? DWARF_DATA_PAGES : FP_DATA_PAGES)) * page_size;
+  int first_err = 0;
+  for (int tid : tids) {
+    int fd = perf_event_open(&attr, tid);
+    void *base = fd < 0 ? MAP_FAILED : mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == base) {
+      if (0 == first_err) {
+        first_err = errno;
+      }
+      if (ESRCH != errno) {
+        LOG(DEBUG, "perf event failed, tid: %d, err: %d, errmsg: %s", tid, errno, strerror(errno));
+      }
+      if (fd >= 0) {
+        close(fd);
+      }
+      continue;
+    }
+    rings_.push_back(Ring{.fd_ = fd, .base_ = base, .size_ = size});
+  }
+  if (rings_.empty()) {
+    return 0 == first_err ? ENOENT : first_err;
+  }
+  if (rings_.size() < tids.size()) {
+    LOG(WARN, "perf events opened for %ld of %ld threads, err: %d, errmsg: %s",
+        rings_.size(), tids.size(), first_err, strerror(first_err));
+  }
+  return 0;
+}
+
+int PerfSampler::run(int64_t duration_us, const SampleCb &cb)
+{
+  for (auto &&ring : rings_) {
+    ioctl(ring.fd_, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  int64_t end = common::current_time() + duration_us;
+  int64_t now;
+  while ((now = common::current_time()) < end) {
+    usleep(std::min(DRAIN_INTERVAL_US, end - now));
+    for (auto &&ring : rings_) {
+      drain(ring, cb);
+    }
+  }
+  for (auto &&ring : rings_) {
+    ioctl(ring.fd_, PERF_EVENT_IOC_DISABLE, 0);
+    drain(ring, cb);
+  }
+  return 0;
+}
+
+void PerfSampler::drain(Ring &ring, const SampleCb &cb)
+{
+  auto *meta = (struct perf_event_mmap_page *)ring.base_;
+  const char *data = (const char *)ring.base_ + meta->data_offset;
+  ulong data_size = meta->data_size;
+  ulong head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+  ulong tail = meta->data_tail;
+  while (tail < head) {
+    struct perf_event_header hdr;
+    ulong off = tail % data_size;
+    // a record may wrap around the end of the buffer
+    record_.resize(std::max<size_t>(record_.size(), sizeof(hdr)));
+    for (size_t i = 0; i < sizeof(hdr); i++) {
+      record_[i] = data[(off + i) % data_size];
+    }
+    memcpy(&hdr, record_.data(), sizeof(hdr));
+    if (hdr.size < sizeof(hdr) || tail + hdr.size > head) break;
+    const char *rec = data + off;
+    if (off + hdr.size > data_size) {
+      record_.resize(std::max<size_t>(record_.size(), hdr.size));
+      memcpy(record_.data(), data + off, data_size - off);
+      memcpy(record_.data() + data_size - off, data, hdr.size - (data_size - off));
+      rec = record_.data();
+    }
+    if (PERF_RECORD_SAMPLE == hdr.type) {
+      on_sample(rec, hdr.size, cb);
+    } else if (PERF_RECORD_LOST == hdr.type && hdr.size >= sizeof(hdr) + 2 * sizeof(uint64_t)) {
+      uint64_t lost;
+      memcpy(&lost, rec + sizeof(hdr) + sizeof(uint64_t), sizeof(lost));
+      lost_ += lost;
+    }
+    tail += hdr.size;
+  }
+  __atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+// PERF_SAMPLE_TID, then CALLCHAIN or REGS_USER and STACK_USER, in this order
+void PerfSampler::on_sample(const char *rec, size_t size, const SampleCb &cb)
+{
+  const char *p = rec + sizeof(struct perf_event_header);
+  const char *end = rec + size;
+  auto take = [&](void *v, size_t len) {
+                if (p + len > end) return false;
+                memcpy(v, p, len);
+                p += len;
+                return true;
+              };
+  uint32_t ids[2]; // pid, tid
+  if (!take(ids, sizeof(ids))) return;
+  ulong addrs[256];
+  int n = 0;
+  if (!dwarf_) {
+    uint64_t nr = 0;
+    if (!take(&nr, sizeof(nr)) || p + nr * sizeof(uint64_t) > end) return;
+    for (uint64_t i = 0; i < nr && n < ARRAYSIZE(addrs); i++) {
+      uint64_t ip;
+      memcpy(&ip, p + i * sizeof(ip), sizeof(ip));
+      // PERF_CONTEXT_USER and friends mark where the kernel or user frames begin
+      if (ip < PERF_CONTEXT_MAX) {
+        addrs[n++] = ip;
+      }
+    }
+  } else {
+    uint64_t abi = 0;
+    if (!take(&abi, sizeof(abi)) || PERF_SAMPLE_REGS_ABI_NONE == abi) return;
+    uint64_t perf_regs[64];
+    int n_regs = __builtin_popcountl(regs_mask());
+    if (!take(perf_regs, n_regs * sizeof(uint64_t))) return;
+    Regs regs;
+    memset(&regs, 0, sizeof(regs));
+    // sample values come in increasing order of perf register number
+    ulong mask = regs_mask();
+    for (auto &&reg : REG_MAP) {
+      int idx = __builtin_popcountl(mask & ((1UL << reg.perf_) - 1));
+      memcpy((char *)&regs + reg.offset_, &perf_regs[idx], sizeof(uint64_t));
+    }
+    uint64_t stack_size = 0;
+    if (!take(&stack_size, sizeof(stack_size)) || p + stack_size > end) return;
+    const char *stack = p;
+    p += stack_size;
+    uint64_t dyn_size = 0;
+    if (stack_size > 0 && !take(&dyn_size, sizeof(dyn_size))) return;
+    stack_start_ = get_sp(regs);
+    stack_ = stack;
+    stack_len_ = std::min(stack_size, dyn_size);
+    n = unwinder_.unwind(regs, addrs, ARRAYSIZE(addrs));
+    stack_ = nullptr;
+    stack_len_ = 0;
+  }
+  if (n > 0) {
+    samples_++;
+    cb(ids[1], addrs, n);
+  }
+}
+
+// the sampled stack, then read-only module bytes from the local file, then the live process
+int PerfSampler::read(ulong addr, void *buf, size_t len)
+{
+  if (stack_ && addr >= stack_start_ && addr + len <= stack_start_ + stack_len_) {
+    memcpy(buf, stack_ + (addr - stack_start_), len);
+    return 0;
+  }
+  auto it = std::upper_bound(modules_.begin(), modules_.end(), addr,
+                             [](ulong addr, const Module &m) { return addr < m.end_; });
+  if (it != modules_.end() && addr >= it->start_ && it->meta_ &&
+      0 == it->meta_->read(addr - (it->start_ - it->meta_->load_vaddr_), buf, len)) {
+    return 0;
+  }
+  struct iovec local = {.iov_base = buf, .iov_len = len};
+  struct iovec remote = {.iov_base = (void *)addr, .iov_len = len};
+  return (ssize_t)len == process_vm_readv(pid_, &local, 1, &remote, 1, 0) ? 0 : -1;
+}
+}
+}
@@ -0,0 +1,86 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNWIND_PERF_SAMPLER_H_
+#define UNWIND_PERF_SAMPLER_H_
+
+#include <functional>
+#include <vector>
+#include "unwind/unwinder.h"
+
+namespace _obstack
+{
+namespace unwind
+{
+/*
+ * Samples the user stacks of running threads with perf_event_open, one
+ * task-clock event and ring buffer per thread, nobody is stopped. In the
+ * callchain mode the kernel walks frame pointers; in the dwarf mode the
+ * registers and the top of the stack come with each sample and are
+ * unwound here, module text from the local files, the rest read live.
+ */
+class PerfSampler : public Memory
+{
+  struct Ring
+  {
+    int fd_;
+    void *base_;
+    size_t size_;
+  };
+  struct Module
+  {
+    ulong start_;
+    ulong end_;
+    const bfdutils::ElfMeta *meta_;
+  };
+public:
+  typedef std::function<void(int tid, const ulong *addrs, int n)> SampleCb;
+  // bytes of user stack copied per sample in the dwarf mode
+  static const int STACK_SIZE = 16 << 10;
+  PerfSampler(int pid, bool dwarf);
+  ~PerfSampler();
+  // modules the dwarf unwinder may run into
+  void add_module(ulong start, ulong end, const bfdutils::ElfMeta *meta);
+  // an errno, ENOMEM if the dwarf unwinder cannot be set up, else fails only
+  // if not a single thread could be opened, with the errno of the first failure
+  int open(const std::vector<int> &tids, int freq);
+  // sample for duration_us, cb gets the user frames of every sample, innermost first
+  int run(int64_t duration_us, const SampleCb &cb);
+  int read(ulong addr, void *buf, size_t len) override;
+  int64_t samples() const { return samples_; }
+  int64_t lost() const { return lost_; }
+private:
+  void drain(Ring &ring, const SampleCb &cb);
+  void on_sample(const char *rec, size_t size, const SampleCb &cb);
+private:
+  int pid_;
+  bool dwarf_;
+  std::vector<Ring> rings_;
+  std::vector<Module> modules_;
+  Unwinder unwinder_;
+  std::vector<char> record_;
+  // stack bytes of the sample being unwound, from sp upwards
+  ulong stack_start_;
+  const char *stack_;
+  size_t stack_len_;
+  int64_t samples_;
+  int64_t lost_;
+};
+}
+}
+
+#endif // UNWIND_PERF_SAMPLER_H_
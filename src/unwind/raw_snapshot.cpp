@@ -0,0 +1,288 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "unwind/raw_snapshot.h"
+
+#include <link.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <unistd.h>
+#include <unordered_set>
+#include <sys/uio.h>
+#include <sys/procfs.h>
+#include "bfd/elf_meta.h"
+#include "common/log.h"
+#include "utils/defer.h"
+#include "utils/util.h"
+#include "lib/macro_utils.h"
+
+using namespace std;
+
+namespace _obstack
+{
+namespace unwind
+{
+struct FileMap
+{
+  ulong start_;
+  ulong end_;
+  ulong offset_;
+  uint flags_;
+  string path_;
+};
+
+static void add_note(string &notes, const char *name, uint type, const void *desc, size_t len)
+{
+  static const char zeros[4] = {};
+  ElfW(Nhdr) nhdr;
+  nhdr.n_namesz = strlen(name) + 1;
+  nhdr.n_descsz = len;
+  nhdr.n_type = type;
+  notes.append((const char *)&nhdr, sizeof(nhdr));
+  notes.append(name, nhdr.n_namesz);
+  notes.append(zeros, (4 - nhdr.n_namesz % 4) % 4);
+  notes.append((const char *)desc, len);
+  notes.append(zeros, (4 - len % 4) % 4);
+}
+
+// every mapping, file-backed ones have an absolute path
+static void read_maps(int pid, vector<FileMap> &maps)
+{
+  char fn[64];
+  snprintf(fn, sizeof(fn), "/proc/%d/maps", pid);
+  FILE *fp = fopen(fn, "rt");
+  if (!fp) return;
+  DEFER(fclose(fp));
+  char line[1024];
+  while (fgets(line, sizeof(line), fp)) {
+    ulong start, end, offset, inode;
+    char perms[8];
+    int pos = 0;
+    if (5 != sscanf(line, "%lx-%lx %4s %lx %*x:%*x %lu %n", &start, &end, perms, &offset, &inode, &pos)) {
+      continue;
+    }
+    uint flags = ('r' == perms[0] ? PF_R : 0) | ('w' == perms[1] ? PF_W : 0) | ('x' == perms[2] ? PF_X : 0);
+    maps.push_back({.start_ = start, .end_ = end, .offset_ = offset, .flags_ = flags,
+                    .path_ = 0 == inode ? "" : common::trim(line + pos)});
+  }
+}
+
+static string read_auxv(int pid)
+{
+  char fn[64];
+  snprintf(fn, sizeof(fn), "/proc/%d/auxv", pid);
+  string auxv;
+  FILE *fp = fopen(fn, "rb");
+  if (!fp) return auxv;
+  DEFER(fclose(fp));
+  char buf[1024];
+  size_t n = 0;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    auxv.append(buf, n);
+  }
+  return auxv;
+}
+
+void RawSnapshot::add_thread(int tid, const char *name, const Regs &regs, ulong stack_start,
+                             const char *stack, int64_t stack_len)
+{
+  threads_.push_back({.tid_ = tid, .name_ = name, .regs_ = regs, .stack_start_ = stack_start,
+                      .stack_ = stack, .stack_len_ = stack_len});
+}
+
+int RawSnapshot::save(const char *file)
+{
+  vector<FileMap> maps;
+  read_maps(pid_, maps);
+  // the stack copy may run into the next mapping
+  for (auto &&thread : threads_) {
+    ulong sp = get_sp(thread.regs_);
+    auto it = std::upper_bound(maps.begin(), maps.end(), sp, [](ulong addr, const FileMap &m) { return addr < m.end_; });
+    if (it != maps.end() && sp >= it->start_) {
+      thread.stack_len_ = std::min(thread.stack_len_, (int64_t)(it->end_ - thread.stack_start_));
+    }
+  }
+  // anonymous mappings, JIT code included, are not saved: their bytes are
+  // not copied, and --load_raw finds no file to read them from either
+  maps.erase(std::remove_if(maps.begin(), maps.end(), [](const FileMap &m) { return '/' != m.path_[0]; }),
+             maps.end());
+
+  string notes;
+  prpsinfo_t info;
+  memset(&info, 0, sizeof(info));
+  info.pr_pid = pid_;
+  for (auto &&thread : threads_) {
+    if (thread.tid_ == pid_ || 0 == info.pr_fname[0]) {
+      strncpy(info.pr_fname, thread.name_.c_str(), sizeof(info.pr_fname));
+    }
+  }
+  add_note(notes, "CORE", NT_PRPSINFO, &info, sizeof(info));
+  for (auto &&thread : threads_) {
+    prstatus_t status;
+    memset(&status, 0, sizeof(status));
+    status.pr_pid = thread.tid_;
+    memcpy(&status.pr_reg, &thread.regs_, sizeof(thread.regs_));
+    add_note(notes, "CORE", NT_PRSTATUS, &status, sizeof(status));
+    string desc((const char *)&thread.tid_, sizeof(thread.tid_));
+    desc.append(thread.name_.c_str(), thread.name_.length() + 1);
+    add_note(notes, OBSTACK_NOTE_NAME, NT_OBSTACK_THREAD_NAME, desc.data(), desc.length());
+  }
+  string auxv = read_auxv(pid_);
+  add_note(notes, "CORE", NT_AUXV, auxv.data(), auxv.length());
+
+  // see CoreFile::parse_file_note
+  ulong page_size = getpagesize();
+  vector<ulong> file_note{maps.size(), page_size};
+  string names;
+  for (auto &&map : maps) {
+    file_note.insert(file_note.end(), {map.start_, map.end_, map.offset_ / page_size});
+    names.append(map.path_.c_str(), map.path_.length() + 1);
+  }
+  string desc((const char *)file_note.data(), file_note.size() * sizeof(ulong));
+  desc.append(names);
+  add_note(notes, "CORE", NT_FILE, desc.data(), desc.length());
+
+  unordered_set<string> paths;
+  for (auto &&map : maps) {
+    if (0 == (map.flags_ & PF_X) || !paths.insert(map.path_).second) continue;
+    auto *meta = ELF_META.get(map.path_);
+    if (meta->build_id_.empty()) continue;
+    string desc = map.path_;
+    desc.push_back('\0');
+    desc.append(meta->build_id_.c_str(), meta->build_id_.length() + 1);
+    add_note(notes, OBSTACK_NOTE_NAME, NT_OBSTACK_BUILD_ID, desc.data(), desc.length());
+  }
+
+  // PT_NOTE, one PT_LOAD without bytes per file map for the permissions, one PT_LOAD per stack
+  vector<ElfW(Phdr)> phdrs;
+  ulong phnum = 1 + maps.size() + threads_.size();
+  ulong offset = sizeof(ElfW(Ehdr)) + phnum * sizeof(ElfW(Phdr));
+  ElfW(Phdr) phdr;
+  memset(&phdr, 0, sizeof(phdr));
+  phdr.p_type = PT_NOTE;
+  phdr.p_offset = offset;
+  phdr.p_filesz = notes.length();
+  phdrs.push_back(phdr);
+  offset += notes.length();
+  for (auto &&map : maps) {
+    memset(&phdr, 0, sizeof(phdr));
+    phdr.p_type = PT_LOAD;
+    phdr.p_offset = offset;
+    phdr.p_vaddr = map.start_;
+    phdr.p_memsz = map.end_ - map.start_;
+    phdr.p_flags = map.flags_;
+    phdr.p_align = page_size;
+    phdrs.push_back(phdr);
+  }
+  for (auto &&thread : threads_) {
+    memset(&phdr, 0, sizeof(phdr));
+    phdr.p_type = PT_LOAD;
+    phdr.p_offset = offset;
+    phdr.p_vaddr = thread.stack_start_;
+    phdr.p_filesz = thread.stack_len_;
+    phdr.p_memsz = thread.stack_len_;
+    phdr.p_flags = PF_R | PF_W;
+    phdr.p_align = 1;
+    phdrs.push_back(phdr);
+    offset += thread.stack_len_;
+  }
+
+  ElfW(Ehdr) ehdr;
+  memset(&ehdr, 0, sizeof(ehdr));
+  memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+  ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+  ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+  ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+  ehdr.e_ident[EI_OSABI] = ELFOSABI_NONE;
+  ehdr.e_type = ET_CORE;
+#if defined(__x86_64__)
+  ehdr.e_machine = EM_X86_64;
+#elif defined(__aarch64__)
+  ehdr.e_machine = EM_AARCH64;
+#endif
+  ehdr.e_version = EV_CURRENT;
+  ehdr.e_phoff = sizeof(ehdr);
+  ehdr.e_ehsize = sizeof(ehdr);
+  ehdr.e_phentsize = sizeof(ElfW(Phdr));
+  ehdr.e_phnum = phnum;
+  // extended numbering as the kernel does: the count is in sh_info of section 0, after the stacks
+  ElfW(Shdr) shdr;
+  memset(&shdr, 0, sizeof(shdr));
+  if (phnum >= PN_XNUM) {
+    ehdr.e_phnum = PN_XNUM;
+    ehdr.e_shoff = offset;
+    ehdr.e_shentsize = sizeof(shdr);
+    ehdr.e_shnum = 1;
+    shdr.sh_info = phnum;
+    offset += sizeof(shdr);
+  }
+
+  FILE *fp = fopen(file, "wb");
+  if (!fp) {
+    LOG(ERROR, "open raw file failed, file: %s, errno: %d", file, errno);
+    return -1;
+  }
+  bool ok = 1 == fwrite(&ehdr, sizeof(ehdr), 1, fp) &&
+    phdrs.size() == fwrite(phdrs.data(), sizeof(ElfW(Phdr)), phdrs.size(), fp) &&
+    notes.length() == fwrite(notes.data(), 1, notes.length(), fp);
+  for (int i = 0; ok && i < threads_.size(); i++) {
+    ok = threads_[i].stack_len_ == fwrite(threads_[i].stack_, 1, threads_[i].stack_len_, fp);
+  }
+  if (ok && 0 != ehdr.e_shnum) {
+    ok = 1 == fwrite(&shdr, sizeof(shdr), 1, fp);
+  }
+  ok = 0 == fclose(fp) && ok;
+  if (!ok) {
+    LOG(ERROR, "write raw file failed, file: %s, errno: %d", file, errno);
+    return -1;
+  }
+  LOG(INFO, "raw snapshot saved, file: %s, threads: %ld, maps: %ld, size: %lu",
+      file, threads_.size(), maps.size(), offset);
+  return 0;
+}
+
+int64_t read_stack(int pid, ulong sp, char *buf, int64_t size, ulong *start)
+{
+#if defined(__x86_64__)
+  // x86_64 leaf functions may use 128 bytes below sp
+  static const ulong RED_ZONE = 128;
+#else
+  // no red zone in the aarch64 ABI
+  static const ulong RED_ZONE = 0;
+#endif
+  ulong page_size = getpagesize();
+  ulong addr = sp - RED_ZONE;
+  ulong end = addr + size;
+  *start = addr;
+  // one iovec per page, the read stops at the first page that is not mapped
+  struct iovec remote[RawSnapshot::MAX_STACK_SIZE / 4096 + 1];
+  int cnt = 0;
+  while (addr < end && cnt < ARRAYSIZE(remote)) {
+    ulong next = std::min((addr & ~(page_size - 1)) + page_size, end);
+    remote[cnt].iov_base = (void *)addr;
+    remote[cnt].iov_len = next - addr;
+    cnt++;
+    addr = next;
+  }
+  struct iovec local = {.iov_base = buf, .iov_len = (size_t)size};
+  ssize_t n = process_vm_readv(pid, &local, 1, remote, cnt, 0);
+  return n < 0 ? 0 : n;
+}
+
+}
+}
@@ -0,0 +1,73 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNWIND_RAW_SNAPSHOT_H_
+#define UNWIND_RAW_SNAPSHOT_H_
+
+#include <string>
+#include <vector>
+#include "unwind/unwinder.h"
+
+namespace _obstack
+{
+namespace unwind
+{
+using std::string;
+
+// custom notes of a raw snapshot, besides the standard core notes
+#define OBSTACK_NOTE_NAME "OBSTACK"
+enum
+{
+  NT_OBSTACK_THREAD_NAME = 1, // pid_t tid, name
+  NT_OBSTACK_BUILD_ID = 2,    // path, hex build-id
+};
+
+/*
+ * The registers and stack bytes of each thread, plus the maps, auxv and
+ * build-ids of the process, written as a minimal ELF core. Nothing is
+ * unwound or symbolized here, CoreFile loads it on another host.
+ */
+class RawSnapshot
+{
+  struct Thread
+  {
+    int tid_;
+    string name_;
+    Regs regs_;
+    ulong stack_start_;
+    const char *stack_;
+    int64_t stack_len_;
+  };
+public:
+  // upper bound of the stack bytes captured per thread, from sp upwards
+  static const int64_t MAX_STACK_SIZE = 1L << 20;
+  RawSnapshot(int pid) : pid_(pid) {}
+  // stack must be alive until save()
+  void add_thread(int tid, const char *name, const Regs &regs, ulong stack_start,
+                  const char *stack, int64_t stack_len);
+  int save(const char *file);
+private:
+  int pid_;
+  std::vector<Thread> threads_;
+};
+
+// copy the stack of a stopped thread, return the bytes read from *start
+int64_t read_stack(int pid, ulong sp, char *buf, int64_t size, ulong *start);
+}
+}
+
+#endif // UNWIND_RAW_SNAPSHOT_H_
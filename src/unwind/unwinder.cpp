@@ -0,0 +1,245 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "unwind/unwinder.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <algorithm>
+#include "bfd/elf_meta.h"
+#include "common/log.h"
+
+// not in the public headers, same as perf does for its offline unwinding
+extern "C" int UNW_OBJ(dwarf_search_unwind_table)(unw_addr_space_t as, unw_word_t ip, unw_dyn_info_t *di,
+                                                  unw_proc_info_t *pi, int need_unwind_info, void *arg);
+#define dwarf_search_unwind_table UNW_OBJ(dwarf_search_unwind_table)
+
+namespace _obstack
+{
+namespace unwind
+{
+// pointer encodings of .eh_frame_hdr
+static const unsigned char DW_EH_PE_FORMAT_MASK = 0x0f;
+static const unsigned char DW_EH_PE_absptr = 0x00;
+static const unsigned char DW_EH_PE_udata2 = 0x02;
+static const unsigned char DW_EH_PE_udata4 = 0x03;
+static const unsigned char DW_EH_PE_udata8 = 0x04;
+static const unsigned char DW_EH_PE_sdata2 = 0x0a;
+static const unsigned char DW_EH_PE_sdata4 = 0x0b;
+static const unsigned char DW_EH_PE_sdata8 = 0x0c;
+static const unsigned char DW_EH_PE_datarel = 0x30;
+
+#if defined(__x86_64__)
+#define REG(name) offsetof(Regs, name)
+// indexed by libunwind register number
+static const size_t REG_OFFSETS[] = {
+  REG(rax), REG(rdx), REG(rcx), REG(rbx), REG(rsi), REG(rdi), REG(rbp), REG(rsp),
+  REG(r8), REG(r9), REG(r10), REG(r11), REG(r12), REG(r13), REG(r14), REG(r15),
+  REG(rip)
+};
+#undef REG
+#elif defined(__aarch64__)
+// x0-x30, sp, pc and pstate, in libunwind register order already
+static const size_t REG_OFFSETS[] = {
+  0x00, 0x08, 0x10, 0x18, 0x20, 0x28, 0x30, 0x38, 0x40, 0x48, 0x50, 0x58, 0x60, 0x68, 0x70, 0x78,
+  0x80, 0x88, 0x90, 0x98, 0xa0, 0xa8, 0xb0, 0xb8, 0xc0, 0xc8, 0xd0, 0xd8, 0xe0, 0xe8, 0xf0, 0xf8,
+  0x100, 0x108
+};
+#else
+#error "architecture not supported"
+#endif
+
+static int encoded_size(unsigned char enc)
+{
+  switch (enc & DW_EH_PE_FORMAT_MASK) {
+  case DW_EH_PE_absptr:
+    return sizeof(ulong);
+  case DW_EH_PE_udata2:
+  case DW_EH_PE_sdata2:
+    return 2;
+  case DW_EH_PE_udata4:
+  case DW_EH_PE_sdata4:
+    return 4;
+  case DW_EH_PE_udata8:
+  case DW_EH_PE_sdata8:
+    return 8;
+  default:
+    return 0;
+  }
+}
+
+Unwinder::Unwinder(Memory &mem)
+  : mem_(mem), as_(nullptr), regs_(nullptr)
+{}
+
+Unwinder::~Unwinder()
+{
+  if (as_) {
+    unw_destroy_addr_space(as_);
+  }
+}
+
+int Unwinder::init()
+{
+  static unw_accessors_t accessors = {
+    .find_proc_info = find_proc_info,
+    .put_unwind_info = put_unwind_info,
+    .get_dyn_info_list_addr = get_dyn_info_list_addr,
+    .access_mem = access_mem,
+    .access_reg = access_reg,
+    .access_fpreg = access_fpreg,
+    .resume = resume,
+    .get_proc_name = get_proc_name,
+  };
+  as_ = unw_create_addr_space(&accessors, 0);
+  if (!as_) {
+    LOG(ERROR, "unw_create_addr_space failed");
+    return -1;
+  }
+  unw_set_caching_policy(as_, UNW_CACHE_GLOBAL);
+  return 0;
+}
+
+void Unwinder::add_module(ulong start, ulong end, const bfdutils::ElfMeta *meta)
+{
+  Module module{.start_ = start, .end_ = end, .bias_ = 0, .segbase_ = 0, .table_data_ = 0, .table_len_ = 0};
+  const bfdutils::ElfSection *hdr = meta && meta->valid_ ? meta->find_section(".eh_frame_hdr") : nullptr;
+  if (hdr && hdr->size_ >= 4 && hdr->offset_ + hdr->size_ <= meta->size_) {
+    // version, eh_frame_ptr_enc, fde_count_enc, table_enc, eh_frame_ptr, fde_count, table
+    const unsigned char *p = (const unsigned char *)meta->image_ + hdr->offset_;
+    int ptr_size = encoded_size(p[1]);
+    int count_size = encoded_size(p[2]);
+    if (1 == p[0] && (DW_EH_PE_datarel | DW_EH_PE_sdata4) == p[3] && ptr_size > 0 &&
+        (4 == count_size || 8 == count_size) && 4 + ptr_size + count_size <= hdr->size_) {
+      ulong fde_count = 0;
+      if (4 == count_size) {
+        uint32_t count;
+        memcpy(&count, p + 4 + ptr_size, sizeof(count));
+        fde_count = count;
+      } else {
+        memcpy(&fde_count, p + 4 + ptr_size, sizeof(fde_count));
+      }
+      module.bias_ = start - meta->load_vaddr_;
+      module.segbase_ = module.bias_ + hdr->addr_;
+      module.table_data_ = module.segbase_ + 4 + ptr_size + count_size;
+      // each entry is a pair of int32 (initial location, fde)
+      module.table_len_ = fde_count * 2 * sizeof(int32_t) / sizeof(unw_word_t);
+    }
+  }
+  if (0 == module.table_len_) {
+    LOG(DEBUG, "no unwind table, file: %s", meta ? meta->file_.c_str() : "");
+  }
+  auto it = std::upper_bound(modules_.begin(), modules_.end(), start,
+                             [](ulong addr, const Module &m) { return addr < m.start_; });
+  modules_.insert(it, module);
+}
+
+const Unwinder::Module *Unwinder::find_module(ulong ip) const
+{
+  auto it = std::upper_bound(modules_.begin(), modules_.end(), ip,
+                             [](ulong addr, const Module &m) { return addr < m.end_; });
+  return it != modules_.end() && ip >= it->start_ ? &*it : nullptr;
+}
+
+int Unwinder::unwind(const Regs &regs, ulong *addrs, int limit)
+{
+  regs_ = &regs;
+  int n = 0;
+  unw_cursor_t c;
+  int rc = unw_init_remote(&c, as_, this);
+  if (rc < 0) {
+    LOG(WARN, "unw_init_remote failed, err: %d", rc);
+  } else {
+    do {
+      unw_word_t uip;
+      if ((rc = unw_get_reg(&c, UNW_REG_IP, &uip)) < 0) {
+        LOG(WARN, "get reg failed, err: %d", rc);
+        break;
+      }
+      addrs[n] = uip;
+    } while (++n < limit && unw_step(&c) > 0);
+  }
+  regs_ = nullptr;
+  return n;
+}
+
+int Unwinder::find_proc_info(unw_addr_space_t as, unw_word_t ip, unw_proc_info_t *pi,
+                             int need_unwind_info, void *arg)
+{
+  auto *self = (Unwinder *)arg;
+  auto *module = self->find_module(ip);
+  if (!module || 0 == module->table_len_) {
+    return -UNW_ENOINFO;
+  }
+  unw_dyn_info_t di;
+  memset(&di, 0, sizeof(di));
+  di.format = UNW_INFO_FORMAT_REMOTE_TABLE;
+  di.start_ip = module->start_;
+  di.end_ip = module->end_;
+  di.u.rti.segbase = module->segbase_;
+  di.u.rti.table_data = module->table_data_;
+  di.u.rti.table_len = module->table_len_;
+  return dwarf_search_unwind_table(as, ip, &di, pi, need_unwind_info, arg);
+}
+
+void Unwinder::put_unwind_info(unw_addr_space_t as, unw_proc_info_t *pi, void *arg)
+{
+  // the unwind info of remote tables is owned by libunwind
+}
+
+int Unwinder::get_dyn_info_list_addr(unw_addr_space_t as, unw_word_t *dil_addr, void *arg)
+{
+  return -UNW_ENOINFO;
+}
+
+int Unwinder::access_mem(unw_addr_space_t as, unw_word_t addr, unw_word_t *valp, int write, void *arg)
+{
+  auto *self = (Unwinder *)arg;
+  if (write) {
+    return -UNW_EINVAL;
+  }
+  return 0 == self->mem_.read(addr, valp, sizeof(*valp)) ? 0 : -UNW_EINVAL;
+}
+
+int Unwinder::access_reg(unw_addr_space_t as, unw_regnum_t regnum, unw_word_t *valp, int write, void *arg)
+{
+  auto *self = (Unwinder *)arg;
+  if (write || !self->regs_ || regnum < 0 || regnum >= sizeof(REG_OFFSETS) / sizeof(REG_OFFSETS[0])) {
+    return -UNW_EBADREG;
+  }
+  memcpy(valp, (const char *)self->regs_ + REG_OFFSETS[regnum], sizeof(*valp));
+  return 0;
+}
+
+int Unwinder::access_fpreg(unw_addr_space_t as, unw_regnum_t regnum, unw_fpreg_t *fpvalp, int write, void *arg)
+{
+  return -UNW_EBADREG;
+}
+
+int Unwinder::resume(unw_addr_space_t as, unw_cursor_t *cp, void *arg)
+{
+  return -UNW_EINVAL;
+}
+
+int Unwinder::get_proc_name(unw_addr_space_t as, unw_word_t addr, char *bufp, size_t buf_len,
+                            unw_word_t *offp, void *arg)
+{
+  return -UNW_EINVAL;
+}
+
+}
+}
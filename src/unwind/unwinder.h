@@ -0,0 +1,99 @@
+/**
+ * Copyright (C) 2024 OceanBase
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNWIND_UNWINDER_H_
+#define UNWIND_UNWINDER_H_
+
+#include <vector>
+#include <sys/types.h>
+#include <sys/user.h>
+#include <libunwind.h>
+
+namespace _obstack
+{
+namespace bfdutils
+{
+struct ElfMeta;
+}
+namespace unwind
+{
+// general purpose registers of a stopped thread, same layout as elf_gregset_t
+typedef struct user_regs_struct Regs;
+
+inline ulong get_sp(const Regs &regs)
+{
+#if defined(__x86_64__)
+  return regs.rsp;
+#elif defined(__aarch64__)
+  return regs.sp;
+#endif
+}
+
+// address space of a thread that is not running, e.g. a core file
+class Memory
+{
+public:
+  virtual ~Memory() {}
+  virtual int read(ulong addr, void *buf, size_t len) = 0;
+};
+
+/*
+ * Unwinds saved registers against a Memory instead of a ptraced tid. The
+ * .eh_frame_hdr of each module is located from its ElfMeta, the tables
+ * themselves are read through the Memory.
+ */
+class Unwinder
+{
+  struct Module
+  {
+    ulong start_;
+    ulong end_;
+    ulong bias_;
+    // .eh_frame_hdr search table, in target addresses
+    ulong segbase_;
+    ulong table_data_;
+    ulong table_len_;
+  };
+public:
+  Unwinder(Memory &mem);
+  ~Unwinder();
+  int init();
+  void add_module(ulong start, ulong end, const bfdutils::ElfMeta *meta);
+  // return addresses, innermost first
+  int unwind(const Regs &regs, ulong *addrs, int limit);
+private:
+  const Module *find_module(ulong ip) const;
+  static int find_proc_info(unw_addr_space_t as, unw_word_t ip, unw_proc_info_t *pi,
+                            int need_unwind_info, void *arg);
+  static void put_unwind_info(unw_addr_space_t as, unw_proc_info_t *pi, void *arg);
+  static int get_dyn_info_list_addr(unw_addr_space_t as, unw_word_t *dil_addr, void *arg);
+  static int access_mem(unw_addr_space_t as, unw_word_t addr, unw_word_t *valp, int write, void *arg);
+  static int access_reg(unw_addr_space_t as, unw_regnum_t regnum, unw_word_t *valp, int write, void *arg);
+  static int access_fpreg(unw_addr_space_t as, unw_regnum_t regnum, unw_fpreg_t *fpvalp, int write, void *arg);
+  static int resume(unw_addr_space_t as, unw_cursor_t *cp, void *arg);
+  static int get_proc_name(unw_addr_space_t as, unw_word_t addr, char *bufp, size_t buf_len,
+                           unw_word_t *offp, void *arg);
+private:
+  Memory &mem_;
+  unw_addr_space_t as_;
+  std::vector<Module> modules_;
+  const Regs *regs_;
+};
+}
+}
+
+#endif // UNWIND_UNWINDER_H_
@@ -21,7 +21,10 @@
 #include <iostream>
 #include <utility>
 #include <string>
+#include <vector>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include "common/log.h"
@@ -54,6 +57,28 @@ inline bool file_exist(const std::string &name)
   return (stat (name.c_str(), &buffer) == 0);
 }
 
+// initiate async readahead so that later reads hit the page cache
+inline void prefetch_file(const char *path)
+{
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) return;
+  (void)posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+  ::close(fd);
+}
+
+// resident set size of the calling process in bytes, 0 if unknown
+inline int64_t current_rss()
+{
+  int64_t size = 0, resident = 0;
+  FILE *fp = fopen("/proc/self/statm", "r");
+  if (!fp) return 0;
+  if (2 != fscanf(fp, "%ld %ld", &size, &resident)) {
+    resident = 0;
+  }
+  fclose(fp);
+  return resident * getpagesize();
+}
+
 inline int64_t current_time()
 {
   int err_ret = 0;
@@ -66,6 +91,25 @@ inline int64_t current_time()
           static_cast<int64_t>(t.tv_usec));
 }
 
+// fast non-cryptographic hash over a sequence of 64-bit words
+inline uint64_t hash_u64s(const unsigned long *vals, int64_t n)
+{
+  uint64_t h = 0xcbf29ce484222325UL ^ (uint64_t)n;
+  for (int64_t i = 0; i < n; i++) {
+    h = (h ^ vals[i]) * 0x9e3779b97f4a7c15UL;
+    h ^= h >> 32;
+  }
+  return h;
+}
+
+struct U64VecHash
+{
+  size_t operator()(const std::vector<unsigned long> &vals) const
+  {
+    return hash_u64s(vals.data(), vals.size());
+  }
+};
+
 inline char *ltrim(char *s)
 {
   while(isspace(*s)) s++;